@@ -71,6 +71,8 @@ int main(int argc, char** argv)
         return 1;
       }
       gFzx.setThreads(std::stoi(argv[i]));
+    } else if (arg == "-n"sv || arg == "--numa"sv) {
+      gFzx.setNuma(true);
     } else {
       fprintf(stderr, "Unknown argument: %s\n", argv[i]);
       return 1;
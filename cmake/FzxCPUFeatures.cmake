@@ -1,51 +1,62 @@
+include(CheckCXXSourceCompiles)
 include(CheckCXXSourceRuns)
 include(CMakePushCheckState)
 
-cmake_push_check_state(RESET)
-  set(CMAKE_REQUIRED_FLAGS "-msse2")
-  check_cxx_source_runs("
-    #include <emmintrin.h>
-    int main() {
-      __m128i r = _mm_add_epi8(
-        _mm_setzero_si128(),
-        _mm_setzero_si128());
-    }
-  " FZX_HAS_SSE2)
-cmake_pop_check_state()
+# With runtime dispatch the kernels only have to compile, the CPU is checked at runtime.
+# Otherwise the whole build targets these features, so the build machine has to run them.
+macro(fzx_check_cpu_feature flags source var)
+  cmake_push_check_state(RESET)
+    set(CMAKE_REQUIRED_FLAGS "${flags}")
+    if(FZX_ENABLE_DISPATCH)
+      check_cxx_source_compiles("${source}" ${var})
+    else()
+      check_cxx_source_runs("${source}" ${var})
+    endif()
+  cmake_pop_check_state()
+endmacro()
 
-cmake_push_check_state(RESET)
-  set(CMAKE_REQUIRED_FLAGS "-msse4.1")
-  check_cxx_source_runs("
-    #include <smmintrin.h>
-    int main() {
-      __m128 r = _mm_blendv_ps(
-        _mm_setzero_ps(),
-        _mm_setzero_ps(),
-        _mm_setzero_ps());
-    }
-  " FZX_HAS_SSE41)
-cmake_pop_check_state()
+fzx_check_cpu_feature("-msse2" "
+  #include <emmintrin.h>
+  int main() {
+    __m128i r = _mm_add_epi8(
+      _mm_setzero_si128(),
+      _mm_setzero_si128());
+  }
+" FZX_HAS_SSE2)
 
-cmake_push_check_state(RESET)
-  set(CMAKE_REQUIRED_FLAGS "-mavx")
-  check_cxx_source_runs("
-    #include <immintrin.h>
-    int main() {
-      __m256 r = _mm256_add_ps(
-        _mm256_setzero_ps(),
-        _mm256_setzero_ps());
-    }
-  " FZX_HAS_AVX)
-cmake_pop_check_state()
+fzx_check_cpu_feature("-msse4.1" "
+  #include <smmintrin.h>
+  int main() {
+    __m128 r = _mm_blendv_ps(
+      _mm_setzero_ps(),
+      _mm_setzero_ps(),
+      _mm_setzero_ps());
+  }
+" FZX_HAS_SSE41)
 
-cmake_push_check_state(RESET)
-  set(CMAKE_REQUIRED_FLAGS "-mavx2")
-  check_cxx_source_runs("
-    #include <immintrin.h>
-    int main() {
-      __m256i r = _mm256_add_epi8(
-        _mm256_setzero_si256(),
-        _mm256_setzero_si256());
-    }
-  " FZX_HAS_AVX2)
-cmake_pop_check_state()
+fzx_check_cpu_feature("-mavx" "
+  #include <immintrin.h>
+  int main() {
+    __m256 r = _mm256_add_ps(
+      _mm256_setzero_ps(),
+      _mm256_setzero_ps());
+  }
+" FZX_HAS_AVX)
+
+fzx_check_cpu_feature("-mavx2" "
+  #include <immintrin.h>
+  int main() {
+    __m256i r = _mm256_add_epi8(
+      _mm256_setzero_si256(),
+      _mm256_setzero_si256());
+  }
+" FZX_HAS_AVX2)
+
+fzx_check_cpu_feature("-mavx512bw" "
+  #include <immintrin.h>
+  int main() {
+    __mmask64 r = _mm512_cmpeq_epi8_mask(
+      _mm512_setzero_si512(),
+      _mm512_setzero_si512());
+  }
+" FZX_HAS_AVX512)
@@ -11,6 +11,9 @@ local util = require('fzx.util')
 local clamp = util.clamp
 local reverse = util.reverse
 
+-- Read through FFI if possible, so that redraws don't create a table for every row
+local results = require('fzx.results')
+
 local mt = { __index = {} }
 
 function mt.__index:destroy()
@@ -65,9 +68,18 @@ function mt.__index:redraw_display()
   end
 
   local height = self._ui:get_preferred_height()
-  local res = self._fzx:get_results(height, self._offset)
-  reverse(res.items)
-  self._results = res
+  local res
+  if results then
+    res = results.get(self._fzx, height, self._offset)
+  else
+    res = self._fzx:get_results(height, self._offset, { ranges = true })
+    if res then
+      reverse(res.items)
+    end
+  end
+  if not res then
+    return
+  end
   self._offset = res.offset
   self._processing = res.processing
 
@@ -88,21 +100,41 @@ function mt.__index:redraw_display()
 
   self._ui:set_height(res.matched)
 
+  local function highlight(lnum, col, end_col)
+    api.nvim_buf_set_extmark(self._ui.display.buf, ns, lnum, col, {
+      end_row = lnum,
+      end_col = end_col,
+      hl_group = 'FzxMatch',
+      priority = 150,
+    })
+  end
+
   local lines = {}
-  for _, item in ipairs(res.items) do
-    table.insert(lines, item.text)
+  if results then
+    -- Best result goes to the bottom
+    for i = res.size - 1, 0, -1 do
+      table.insert(lines, results.text(res, i))
+    end
+  else
+    for _, item in ipairs(res.items) do
+      table.insert(lines, item.text)
+    end
   end
   api.nvim_buf_clear_namespace(self._ui.display.buf, ns, 0, -1)
   api.nvim_buf_set_lines(self._ui.display.buf, 0, -1, false, lines)
-  for lnum, item in ipairs(res.items) do
-    for col, matched in ipairs(item.positions) do
-      if matched then
-        api.nvim_buf_set_extmark(self._ui.display.buf, ns, lnum - 1, col - 1, {
-          end_row = lnum - 1,
-          end_col = col,
-          hl_group = 'FzxMatch',
-          priority = 150,
-        })
+  if results then
+    for i = 0, res.size - 1 do
+      local row = res.rows[i]
+      local lnum = res.size - 1 - i
+      for k = row.ranges_begin, row.ranges_end - 1 do
+        highlight(lnum, res.ranges[k * 2], res.ranges[k * 2 + 1])
+      end
+    end
+  else
+    for lnum, item in ipairs(res.items) do
+      local ranges = item.ranges
+      for i = 1, #ranges, 2 do
+        highlight(lnum - 1, ranges[i], ranges[i + 1])
       end
     end
   end
@@ -110,6 +142,26 @@ function mt.__index:redraw_display()
   self:update_cursor()
 end
 
+-- Text and index of the result under the cursor. Fetched again, the results of the last redraw
+-- can be out of date, items may have been pushed since.
+function mt.__index:selected()
+  if not self._fzx or self._fzx:is_nil() then
+    return
+  end
+  if results then
+    local res = results.get(self._fzx, self._cursor + 1, self._offset)
+    if res and self._cursor < res.size then
+      return results.text(res, self._cursor), res.rows[self._cursor].index
+    end
+  else
+    local res = self._fzx:get_results(self._cursor + 1, self._offset)
+    local item = res and res.items[self._cursor + 1]
+    if item then
+      return item.text, item.index
+    end
+  end
+end
+
 function mt.__index:scroll_relative(n)
   self._offset = math.floor(clamp(self._offset + n, 0, require('fzxlua').MAX_OFFSET))
   self:redraw_display()
@@ -145,6 +197,8 @@ local function new(opts)
     'opts.prompt has to be a non empty string')
   assert(opts.on_select == nil or type(opts.on_select) == 'function',
     'opts.on_select has to be a function')
+  assert(opts.case == nil or opts.case == 'insensitive' or opts.case == 'sensitive'
+    or opts.case == 'smart', "opts.case has to be 'insensitive', 'sensitive' or 'smart'")
 
   local self = setmetatable({}, mt)
   self._pending = false
@@ -154,6 +208,7 @@ local function new(opts)
   self._query = ''
   self._on_select = opts.on_select
   self._fzx = require('fzx.lib')({
+    case = opts.case,
     on_update = function()
       if self._pending then
         return
@@ -241,22 +296,21 @@ local function new(opts)
     self:destroy()
   end, { buffer = self._ui.input.buf, nowait = true })
   vim.keymap.set('n', '<Enter>', function()
-    local items = self._results.items
-    local item = items[#items - self._cursor]
+    -- Results are gone after destroy
+    local text, index = self:selected()
     self:destroy()
-    if item and self._on_select then
-      self._on_select(item.text, item.index)
+    if text and self._on_select then
+      self._on_select(text, index)
     end
   end, { buffer = self._ui.input.buf })
   vim.keymap.set('i', '<Enter>', function()
-    local items = self._results.items
-    local item = items[#items - self._cursor]
+    local text, index = self:selected()
     self:destroy()
     vim.cmd('stopinsert')
-    if item and self._on_select then
+    if text and self._on_select then
       -- :stopinsert interferes with cursor position
       vim.schedule(function()
-        self._on_select(item.text, item.index)
+        self._on_select(text, index)
       end)
     end
   end, { buffer = self._ui.input.buf })
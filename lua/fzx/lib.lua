@@ -45,6 +45,12 @@ function mt.__index:scan_feed(data)
   end
 end
 
+function mt.__index:load_file(path)
+  if not self:is_nil() then
+    self.fzx:load_file(path)
+  end
+end
+
 function mt.__index:push(...)
   if not self:is_nil() then
     self.fzx:push(...)
@@ -63,12 +69,24 @@ function mt.__index:set_query(query)
   end
 end
 
+function mt.__index:set_threads(threads)
+  if not self:is_nil() then
+    self.fzx:set_threads(threads)
+  end
+end
+
 function mt.__index:get_results(...)
   if not self:is_nil() then
     return self.fzx:get_results(...)
   end
 end
 
+function mt.__index:get_results_buffer(...)
+  if not self:is_nil() then
+    return self.fzx:get_results_buffer(...)
+  end
+end
+
 local function new(opts)
   assert(type(opts) == 'table', 'opts has to be a table')
   assert(opts.on_update == nil or type(opts.on_update) == 'function',
@@ -77,7 +95,9 @@ local function new(opts)
   local on_update = opts.on_update
   local self = setmetatable({}, mt)
   self.fzx = require('fzxlua').new({
-    threads = vim.loop.available_parallelism(),
+    threads = 'auto',
+    limit = 1024,
+    case = opts.case,
   })
   self._poll = assert(vim.loop.new_poll(self.fzx:get_fd()))
   self._poll:start('r', function(err)
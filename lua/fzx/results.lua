@@ -0,0 +1,52 @@
+-- Results written by get_results_buffer, read with LuaJIT FFI. Nothing is allocated per row,
+-- text of a row is turned into a Lua string only when asked for. Nil without LuaJIT.
+
+local ok, ffi = pcall(require, 'ffi')
+if not ok then
+  return nil
+end
+
+-- Has to match ResultsBuffer in src/fzx/lua/fzx.cpp. Declared only once, ffi.cdef fails on
+-- redefinitions when the module is loaded again.
+if not pcall(ffi.typeof, 'fzx_results') then
+  ffi.cdef([[
+typedef struct {
+  uint32_t index;
+  float score;
+  uint32_t text_begin;
+  uint32_t text_end;
+  uint32_t ranges_begin;
+  uint32_t ranges_end;
+} fzx_results_row;
+
+typedef struct {
+  uint32_t total;
+  uint32_t matched;
+  uint32_t offset;
+  uint32_t size;
+  float progress;
+  bool processing;
+  const fzx_results_row *rows;
+  const uint32_t *ranges;
+  const char *text;
+} fzx_results;
+]])
+end
+
+local M = {}
+
+-- Get up to `max` results starting at `offset`. Valid until the next call for the same instance.
+function M.get(fzx, max, offset)
+  local ptr = fzx:get_results_buffer(max, offset)
+  if ptr then
+    return ffi.cast('const fzx_results *', ptr)
+  end
+end
+
+-- Text of the row `i`, starting at 0
+function M.text(res, i)
+  local row = res.rows[i]
+  return ffi.string(res.text + row.text_begin, row.text_end - row.text_begin)
+end
+
+return M
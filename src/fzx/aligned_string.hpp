@@ -38,6 +38,7 @@ struct AlignedString
   {
     if (this == &b)
       return *this;
+    alignedFree(mPtr);
     mPtr = std::exchange(b.mPtr, nullptr);
     mEnd = std::exchange(b.mEnd, nullptr);
     return *this;
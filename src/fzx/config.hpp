@@ -9,9 +9,23 @@ namespace fzx {
 /// Lower values will synchronize threads more often and will have more L1 cache misses.
 static constexpr auto kChunkSize = 0x4000;
 
+/// Take at least N items at once, even when they are slow to process.
+static constexpr auto kMinChunkSize = 0x100;
+
+/// Chunks are sized to take about this long, in nanoseconds. Appended items are picked up
+/// between chunks, so this bounds how late the workers notice them.
+static constexpr auto kChunkTimeNs = 500'000;
+
+/// Check if the query changed every N items, so the rest of a chunk isn't matched for nothing.
+static constexpr auto kPreemptInterval = 64;
+
 /// Hard limit on 64 threads.
 static constexpr unsigned kMaxThreads = 64;
 
+/// When the number of threads is picked automatically, a worker is added for every N items a
+/// job has to process. Small jobs are done sooner than more threads could even wake up.
+static constexpr auto kAutoItemsPerWorker = 0x8000;
+
 /// CPU cache line size.
 static constexpr auto kCacheLine = 64;
 
@@ -20,4 +34,9 @@ static constexpr auto kCacheLine = 64;
 /// out of bounds memory, without triggering a segfault.
 static constexpr auto kOveralloc = 64;
 
+/// Number of recent queries with their results kept, so that going back to one of them, like
+/// when deleting what was just typed, doesn't process the items again. Each entry keeps its
+/// results alive, 8 bytes per matched item.
+static constexpr auto kResultsCacheSize = 8U;
+
 } // namespace fzx
@@ -0,0 +1,51 @@
+// Licensed under LGPLv3 - see LICENSE file for details.
+
+#include "fzx/cpu.hpp"
+
+namespace fzx {
+
+namespace {
+
+uint32_t detectCpuFeatures() noexcept
+{
+  uint32_t features = 0;
+#if defined(FZX_SSE2)
+  features |= kCpuSSE2;
+#endif
+#if defined(FZX_SSE41)
+  features |= kCpuSSE41;
+#endif
+#if defined(FZX_AVX2)
+  features |= kCpuAVX2;
+#endif
+#if defined(FZX_AVX512)
+  features |= kCpuAVX512;
+#endif
+#if defined(FZX_NEON)
+  features |= kCpuNEON;
+#endif
+
+#if defined(FZX_DISPATCH)
+  // Can be called before the constructors, so the CPU info might not be initialized yet.
+  __builtin_cpu_init();
+  // SSE2 is the baseline, it's always there on x86_64.
+  if (!__builtin_cpu_supports("sse4.1"))
+    features &= ~kCpuSSE41;
+  if (!__builtin_cpu_supports("avx2"))
+    features &= ~kCpuAVX2;
+  if (!__builtin_cpu_supports("avx512f") || !__builtin_cpu_supports("avx512bw"))
+    features &= ~kCpuAVX512;
+#endif
+
+  return features;
+}
+
+} // namespace
+
+uint32_t cpuFeatures() noexcept
+{
+  static const uint32_t kFeatures = detectCpuFeatures();
+  return kFeatures;
+}
+
+} // namespace fzx
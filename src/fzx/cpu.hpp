@@ -0,0 +1,29 @@
+// Licensed under LGPLv3 - see LICENSE file for details.
+
+#pragma once
+
+#include <cstdint>
+
+namespace fzx {
+
+/// CPU features used to select SIMD kernels.
+enum CpuFeature : uint32_t {
+  kCpuSSE2 = 1U << 0,
+  kCpuSSE41 = 1U << 1,
+  kCpuAVX2 = 1U << 2,
+  kCpuAVX512 = 1U << 3, ///< AVX-512F and AVX-512BW
+  kCpuNEON = 1U << 4,
+};
+
+/// Get features that the kernels were built for, and that are supported by the current CPU.
+/// Detected once, on the first call. Without FZX_DISPATCH everything that was enabled at
+/// compile time is assumed to be supported.
+[[nodiscard]] uint32_t cpuFeatures() noexcept;
+
+/// Check if all of the `features` can be used.
+[[nodiscard]] inline bool cpuSupports(uint32_t features) noexcept
+{
+  return (cpuFeatures() & features) == features;
+}
+
+} // namespace fzx
@@ -8,6 +8,7 @@
 
 #include "fzx/config.hpp"
 #include "fzx/macros.hpp"
+#include "fzx/numa.hpp"
 
 namespace fzx {
 
@@ -30,7 +31,19 @@ void Fzx::setCallback(Callback callback, void* userData) noexcept
 
 void Fzx::setThreads(unsigned threads) noexcept
 {
-  mThreads = std::clamp(threads, 1U, kMaxThreads);
+  mThreads = std::min(threads, kMaxThreads);
+}
+
+void Fzx::setResultsLimit(size_t limit) noexcept
+{
+  mResultsLimit = limit;
+  mLimit = limit;
+}
+
+void Fzx::setNuma(bool numa) noexcept
+{
+  ASSERT(!mRunning);
+  mNuma = numa;
 }
 
 void Fzx::start()
@@ -41,13 +54,50 @@ void Fzx::start()
 
   ASSERT(mCallback);
 
-  for (size_t i = 0; i < mThreads; ++i) {
+  mNumaNodes = mNuma ? std::min(numaNodes(), maxWorkers()) : 1;
+  mNodeBounds.clear();
+  mNodeStorage = nullptr;
+  distributeItems();
+  mWorkers.reserve(kMaxThreads);
+  spawnWorkers(std::max<size_t>(mThreads, mJob.mWorkers));
+}
+
+void Fzx::spawnWorkers(size_t n)
+{
+  // The vector never reallocates, the running workers can keep reading it meanwhile.
+  ASSERT(n <= mWorkers.capacity());
+  const size_t max = std::max(maxWorkers(), n);
+  while (mWorkers.size() < n) {
+    const size_t i = mWorkers.size();
     auto& worker = mWorkers.emplace_back(std::make_unique<Worker>());
     worker->mIndex = i;
     worker->mPool = this;
-  }
-  for (const auto& worker : mWorkers)
+    if (mNumaNodes > 1)
+      worker->mNumaNode = static_cast<int>(numaNode(i, max, mNumaNodes));
     worker->mThread = std::thread { &Worker::run, worker.get() };
+  }
+}
+
+size_t Fzx::maxWorkers() const noexcept
+{
+  if (mThreads != 0)
+    return mThreads;
+  static const unsigned kCpus = std::clamp(std::thread::hardware_concurrency(), 1U, kMaxThreads);
+  return kCpus;
+}
+
+size_t Fzx::jobWorkers(size_t work) const noexcept
+{
+  if (mThreads != 0)
+    return mThreads;
+  return std::clamp<size_t>((work + kAutoItemsPerWorker - 1) / kAutoItemsPerWorker, 1,
+                            maxWorkers());
+}
+
+size_t Fzx::jobSize() const noexcept
+{
+  const size_t candidates = mJob.mCandidates ? mJob.mCandidates->size() : 0;
+  return candidates + mItems.size() - mJob.mCandidatesTick - mQueueStart;
 }
 
 void Fzx::stop()
@@ -67,17 +117,22 @@ void Fzx::stop()
 bool Fzx::setQuery(std::string_view query)
 {
   // TODO: parse outside and pass a Query object to this function
-  Query q = Query::parse(query);
+  Query q = Query::parse(query, mCaseMode);
 
   if ((q.empty() && !mQuery) || (!q.empty() && mQuery && *mQuery == q))
     return false;
 
+  // Keep the current results, in case the query comes back.
+  if (const Results* res = getResults(); res != nullptr && res->mQuery && !res->mQuery->empty())
+    mResultsCache.insert(res->mQuery, res->mItems, res->mMatched, res->mItemsTick);
+
   if (!q.empty()) {
     mQuery = std::make_shared<Query>(std::move(q));
   } else {
     mQuery.reset();
   }
 
+  mLimit = mResultsLimit;
   commit();
   return true;
 }
@@ -88,7 +143,16 @@ void Fzx::commit()
   // modify it, so it's safe for us to read it before acquiring a lock.
   bool queryChanged = mJob.mQuery.get() != mQuery.get();
   bool itemsChanged = mJob.mItems.size() != mItems.size();
-  if (!queryChanged && !itemsChanged)
+  // Truncated results can't be reused with a different limit, handle it like a new query.
+  bool limitChanged = mJob.mLimit != mLimit;
+  // The job needs different workers since it started. Either they were set with setThreads, or
+  // they are picked automatically and enough items were appended to use twice as many.
+  bool workersChanged = false;
+  if (mQuery && !queryChanged && !limitChanged) {
+    const size_t workers = jobWorkers(jobSize());
+    workersChanged = mThreads != 0 ? workers != mJob.mWorkers : workers >= mJob.mWorkers * 2;
+  }
+  if (!queryChanged && !itemsChanged && !limitChanged && !workersChanged)
     return;
 
   // TODO: Don't wake up workers when items changed but there is no active query.
@@ -97,30 +161,113 @@ void Fzx::commit()
   // loop should still be notified about it. Figure out if EventFd::notify is safe
   // to call from multiple threads at once.
 
-  bool queueChanged = queryChanged || (itemsChanged && mQuery);
+  if (itemsChanged)
+    distributeItems();
+
+  // The job is started again with the new workers. It continues from the results published so
+  // far through the cache, same as when going back to a previous query.
+  if (workersChanged) {
+    if (const Results* res = getResults(); res != nullptr && res->mQuery == mQuery)
+      mResultsCache.insert(res->mQuery, res->mItems, res->mMatched, res->mItemsTick);
+  }
+
+  // When only new items were appended, the queue is kept and the workers resume from where
+  // they stopped. The results for the items processed so far are still valid.
+  bool queueChanged = queryChanged || limitChanged || workersChanged;
+  std::shared_ptr<const std::vector<MatchedItem>> candidates;
+  size_t candidatesTick = 0;
+  std::shared_ptr<const std::vector<MatchedItem>> cached;
+  size_t cachedMatched = 0;
+  size_t workers = mJob.mWorkers;
   if (queueChanged) {
     if (mQuery) {
-      mQueue = std::make_shared<ItemQueue>();
+      // Results the query had before, if it's active again. The queue continues after the
+      // cached items, like if they were appended since.
+      const auto* entry = mResultsCache.find(*mQuery, mItems.size(), mLimit);
+      mQueueStart = entry != nullptr ? entry->mItemsTick : 0;
+      if (entry != nullptr) {
+        cached = entry->mItems;
+        cachedMatched = entry->mMatched;
+      } else if (const Results* res = refinableResults(*mQuery); res != nullptr) {
+        candidates = res->mItems;
+        candidatesTick = res->mItemsTick;
+      }
+      workers = jobWorkers(candidates ? candidates->size() + mItems.size() - candidatesTick
+                                      : mItems.size() - mQueueStart);
+      mQueue = std::make_shared<ItemQueue>(workers, mQueueStart);
+      // Without candidates, the queue goes through the items in order, so it can follow their
+      // placement. Candidates are ordered by score, they are spread evenly instead.
+      if (!candidates && !mNodeBounds.empty())
+        mQueue->shard(mNodeBounds);
     } else {
       mQueue.reset();
+      mQueueStart = 0;
+      // The master worker alone publishes the empty results.
+      workers = 1;
     }
   }
 
+  // Workers of the previous job are woken up too, so that they can let go of it.
+  const size_t wake = std::max(workers, mJob.mWorkers);
+  if (mRunning)
+    spawnWorkers(workers);
+  auto merge = mQuery ? std::make_shared<Merge>() : nullptr;
+
   {
     std::unique_lock lock { mJobMutex };
+    mJob.mMerge = std::move(merge);
     if (itemsChanged)
       mJob.mItems = mItems;
-    if (queueChanged)
+    if (queueChanged) {
       mJob.mQueue = mQueue;
-    if (queryChanged) {
+      mJob.mCandidates = std::move(candidates);
+      mJob.mCandidatesTick = candidatesTick;
+      mJob.mCached = std::move(cached);
+      mJob.mCachedMatched = cachedMatched;
+      mJob.mWorkers = workers;
       ++mJob.mQueryTick;
       mJob.mQuery = mQuery;
+      mJob.mLimit = mLimit;
     }
   }
+  if (queueChanged)
+    mQueryTick.store(mJob.mQueryTick, std::memory_order_release);
 
   // Wake up worker threads
-  for (auto& worker : mWorkers)
-    worker->mEvents.post(Worker::kJob);
+  for (size_t i = 0; i < std::min(wake, mWorkers.size()); ++i)
+    mWorkers[i]->mEvents.post(Worker::kJob);
+}
+
+void Fzx::distributeItems()
+{
+  if (mNumaNodes < 2 || mItems.size() < mNumaNodes)
+    return;
+  // Moving the pages is expensive, so it's done again only when the items doubled since, or
+  // when the storage was reallocated, and its pages were allocated by this thread.
+  const size_t placed = mNodeBounds.empty() ? 0 : mNodeBounds.back();
+  if (mItems.storage() == mNodeStorage && mItems.size() < placed * 2)
+    return;
+  mNodeBounds.resize(mNumaNodes + 1);
+  for (size_t i = 0; i <= mNumaNodes; ++i)
+    mNodeBounds[i] = mItems.size() * i / mNumaNodes;
+  for (size_t i = 0; i < mNumaNodes; ++i)
+    mItems.bindToNode(mNodeBounds[i], mNodeBounds[i + 1], i);
+  mNodeStorage = mItems.storage();
+}
+
+const Results* Fzx::refinableResults(const Query& query) const noexcept
+{
+  // Results published by the master worker are always complete for their query and items
+  // size, so they contain everything a narrower query can possibly match within these items.
+  const Results* res = getResults();
+  if (res == nullptr || !res->mQuery || res->mItemsTick > mItems.size())
+    return nullptr;
+  // Truncated results don't have everything.
+  if (res->mItems->size() != res->mMatched)
+    return nullptr;
+  if (!query.refines(*res->mQuery))
+    return nullptr;
+  return res;
 }
 
 bool Fzx::loadResults() noexcept
@@ -134,17 +281,37 @@ bool Fzx::loadResults() noexcept
 size_t Fzx::resultsSize() const noexcept
 {
   if (const Results* res = getResults(); res != nullptr && res->mQuery)
-    return res->mItems.size();
+    return res->mMatched;
   return mItems.size();
 }
 
+size_t Fzx::availableResults() const noexcept
+{
+  if (const Results* res = getResults(); res != nullptr && res->mQuery)
+    return res->mItems->size();
+  return mItems.size();
+}
+
+void Fzx::reserveResults(size_t n)
+{
+  if (mLimit == 0 || n <= mLimit)
+    return;
+  // Nothing was left out of the results for the current query.
+  if (const Results* res = getResults(); res != nullptr && res->mQuery == mQuery
+      && res->mItemsTick == mItems.size() && res->mItems->size() == res->mMatched)
+    return;
+  while (mLimit < n)
+    mLimit *= 2;
+  commit();
+}
+
 Result Fzx::getResult(size_t i) const noexcept
 {
   if (const Results* res = getResults(); res != nullptr && res->mQuery) {
-    DEBUG_ASSERT(i < res->mItems.size());
-    if (i >= res->mItems.size())
+    DEBUG_ASSERT(i < res->mMatched);
+    if (i >= res->mItems->size())
       return {};
-    const MatchedItem& match = res->mItems[i];
+    const MatchedItem& match = (*res->mItems)[i];
     return { mItems.at(match.index()), match.index(), match.score() * kScoreMultiplier };
   } else {
     DEBUG_ASSERT(i < mItems.size());
@@ -166,7 +333,8 @@ bool Fzx::processing() const noexcept
   if (!mQuery)
     return false;
   if (const Results* res = getResults(); res != nullptr)
-    return mItems.size() != res->mItemsTick || mQuery.get() != res->mQuery.get();
+    return mItems.size() != res->mItemsTick || mQuery.get() != res->mQuery.get()
+        || mJob.mLimit != res->mLimit;
   return false;
 }
 
@@ -177,14 +345,18 @@ double Fzx::progress() const noexcept
   // This atomic counter can include items that are about to be processed. Also
   // this doesn't include sorting. It's fine though, this is just an approximation.
   const size_t processed = mQueue->get();
-  const size_t total = mItems.size();
+  const size_t candidates = mJob.mCandidates ? mJob.mCandidates->size() : 0;
+  const size_t total = candidates + mItems.size() - mJob.mCandidatesTick;
+  if (total == 0)
+    return 1.0;
   return static_cast<double>(std::min(processed, total)) / static_cast<double>(total);
 }
 
 bool Fzx::synchronized() const noexcept
 {
   if (const Results* res = getResults(); res != nullptr)
-    return mItems.size() == res->mItemsTick && mQuery.get() == res->mQuery.get();
+    return mItems.size() == res->mItemsTick && mQuery.get() == res->mQuery.get()
+        && mJob.mLimit == res->mLimit;
   return true;
 }
 
@@ -16,6 +16,7 @@
 #include "fzx/items.hpp"
 #include "fzx/matched_item.hpp"
 #include "fzx/query.hpp"
+#include "fzx/results_cache.hpp"
 #include "fzx/worker.hpp"
 
 namespace fzx {
@@ -35,10 +36,27 @@ struct Job
   Items mItems;
   /// Active query.
   std::shared_ptr<Query> mQuery;
+  /// Items to process instead of all items, if set. When the active query is a narrowing of
+  /// the previous one, only the results of the previous query have to be filtered again.
+  std::shared_ptr<const std::vector<MatchedItem>> mCandidates;
+  /// Items size the candidates were taken from. Items appended after that are processed as usual.
+  size_t mCandidatesTick { 0 };
+  /// Cached results for the first mQueue items, if set. They are kept by the master worker
+  /// instead of processing those items again.
+  std::shared_ptr<const std::vector<MatchedItem>> mCached;
+  /// Number of items matched by the cached results.
+  size_t mCachedMatched { 0 };
   /// Shared atomic counter for reserving the items for processing.
   std::shared_ptr<ItemQueue> mQueue;
+  /// Max number of results to keep, 0 if unlimited.
+  size_t mLimit { 0 };
   /// Monotonically increasing timestamp identifying the active query.
   size_t mQueryTick { 0 };
+  /// Where the results of the workers are merged. Replaced with every change of the job.
+  std::shared_ptr<Merge> mMerge;
+  /// Number of workers processing the job, the first ones in the pool. Only changes along with
+  /// the query tick. The other workers are parked until a job needs them.
+  size_t mWorkers { 1 };
 };
 
 using Callback = void (*)(void* userData);
@@ -57,13 +75,30 @@ struct Fzx
   /// Callback can be called from different threads, it has to be thread-safe, even
   /// in regards to itself.
   void setCallback(Callback callback, void* userData = nullptr) noexcept;
+  /// Set the number of worker threads. With 0, the number is picked for every job by how many
+  /// items it has to process, up to one per CPU, see kAutoItemsPerWorker. Threads are started
+  /// only once some job needs them. Can be called while running, applied on the next commit.
   void setThreads(unsigned threads) noexcept;
+  /// Keep only the best `limit` results, 0 means unlimited. Sorting and merging only the top
+  /// results is a lot cheaper for broad queries, when only a small window is displayed anyway.
+  /// Results past the limit can be requested with reserveResults. Applied on the next commit.
+  void setResultsLimit(size_t limit) noexcept;
+  /// Set how letter case is matched, see CaseMode. Applied to queries set from now on.
+  void setCaseMode(CaseMode caseMode) noexcept { mCaseMode = caseMode; }
+  /// Spread the workers and the items across NUMA nodes. Workers are pinned to the CPUs of their
+  /// node, the items are split into a shard per node, and workers match the items of their own
+  /// node first. Does nothing on machines with a single node. Applied on start.
+  void setNuma(bool numa) noexcept;
 
   void start();
   void stop();
 
   /// Push string to the list of items.
   void pushItem(std::string_view s) { mItems.push(s); }
+  /// Load items from a file with one item per line, separated by `delimiter`. The file is mapped
+  /// into memory instead of copying each line, see Items::mapFile. Has to be called before any
+  /// item is pushed.
+  void loadFile(const char* path, char delimiter = '\n') { mItems.mapFile(path, delimiter); }
   [[nodiscard]] size_t itemsSize() const noexcept { return mItems.size(); }
   /// Returned string_view can be invalidated after calling `pushItem`.
   [[nodiscard]] std::string_view getItem(size_t i) const noexcept { return mItems.at(i); }
@@ -78,7 +113,15 @@ struct Fzx
 
   /// Load results accessed with resultsSize, getResult, query, processing.
   bool loadResults() noexcept;
+  /// Number of all matched items.
   [[nodiscard]] size_t resultsSize() const noexcept;
+  /// Number of results that can be accessed with getResult.
+  /// Smaller than resultsSize if the results were truncated, see setResultsLimit.
+  [[nodiscard]] size_t availableResults() const noexcept;
+  /// Request at least `n` top results to be available. If the current results were truncated
+  /// below `n`, the results limit is raised and the results are computed again. The limit is
+  /// reset back to what was set by setResultsLimit when the query changes.
+  void reserveResults(size_t n);
   /// Returned value can be invalidated after calling `commit` or `pushItem`.
   [[nodiscard]] Result getResult(size_t i) const noexcept;
   /// Get the original query for the current results.
@@ -113,6 +156,21 @@ private:
     return mWorkers.empty() ? nullptr : mWorkers.front().get();
   }
 
+  /// Get the current results, if they can be used as candidates for `query`.
+  [[nodiscard]] const Results* refinableResults(const Query& query) const noexcept;
+
+  /// Place the items on the NUMA nodes, if they grew enough since the last time.
+  void distributeItems();
+
+  /// Most workers a job can have, see setThreads.
+  [[nodiscard]] size_t maxWorkers() const noexcept;
+  /// Number of workers for a job processing `work` items.
+  [[nodiscard]] size_t jobWorkers(size_t work) const noexcept;
+  /// Number of items the active job processes, including the items appended since it started.
+  [[nodiscard]] size_t jobSize() const noexcept;
+  /// Start worker threads until there are at least `n` of them.
+  void spawnWorkers(size_t n);
+
   /// Load current job, for worker threads
   void loadJob(Job& job) const
   {
@@ -124,16 +182,34 @@ private:
   Items mItems;
   std::shared_ptr<Query> mQuery;
   std::shared_ptr<ItemQueue> mQueue;
-
-  /// Worker threads. This vector is shared with workers, so after
-  /// starting and before joining threads, it cannot be modified.
+  /// Index the queue started at. The items before it are covered by cached results.
+  size_t mQueueStart { 0 };
+  /// Results of the previous queries.
+  ResultsCache mResultsCache;
+
+  /// Worker threads. This vector is shared with workers. Its capacity is reserved on start, so
+  /// that workers can be appended while running, but not removed before joining the threads.
+  /// Workers only access the ones processing the same job.
   std::vector<std::unique_ptr<Worker>> mWorkers {};
 
   Callback mCallback { nullptr };
   void* mUserData { nullptr };
 
-  /// Worker count.
+  /// Worker count, 0 to pick it for every job.
   unsigned mThreads { 1 };
+  /// Results limit set by the user.
+  size_t mResultsLimit { 0 };
+  /// Results limit for the active query. Can be raised by reserveResults.
+  size_t mLimit { 0 };
+  CaseMode mCaseMode { CaseMode::kInsensitive };
+  /// NUMA mode requested by setNuma.
+  bool mNuma { false };
+  /// Number of NUMA nodes the workers and the items are spread across, 1 if not at all.
+  size_t mNumaNodes { 1 };
+  /// Items [mNodeBounds[k], mNodeBounds[k + 1]) are placed on NUMA node k.
+  std::vector<size_t> mNodeBounds;
+  /// String storage of the items when they were placed.
+  const void* mNodeStorage { nullptr };
   /// Keep track of whether the threads are running, to
   /// ensure correct usage of start and stop methods.
   bool mRunning { false };
@@ -143,6 +219,9 @@ private:
   /// They should use loadJob method.
   Job mJob;
   alignas(kCacheLine) mutable std::shared_mutex mJobMutex;
+  /// Query tick of the latest job, stored after the job is updated. Workers poll it while
+  /// processing items, to stop as soon as their query is stale without taking the lock.
+  alignas(kCacheLine) std::atomic<size_t> mQueryTick { 0 };
 
   friend struct Worker;
 };
@@ -0,0 +1,151 @@
+// Licensed under LGPLv3 - see LICENSE file for details.
+
+#include "fzx/item_queue.hpp"
+
+#include <algorithm>
+#include <limits>
+
+#include "fzx/macros.hpp"
+
+namespace fzx {
+
+namespace {
+
+constexpr uint64_t pack(size_t begin, size_t end) noexcept
+{
+  return static_cast<uint64_t>(begin) | (static_cast<uint64_t>(end) << 32);
+}
+
+constexpr size_t begin(uint64_t range) noexcept
+{
+  return static_cast<uint32_t>(range);
+}
+
+constexpr size_t end(uint64_t range) noexcept
+{
+  return static_cast<uint32_t>(range >> 32);
+}
+
+} // namespace
+
+ItemQueue::ItemQueue(size_t workers, size_t index) noexcept
+  : mIndex(index)
+  , mStart(index)
+  , mTailStart(index)
+  , mWorkers(std::clamp<size_t>(workers, 1, kMaxThreads))
+{
+}
+
+std::pair<size_t, size_t> ItemQueue::take(size_t worker, size_t n, size_t max, size_t node) noexcept
+{
+  DEBUG_ASSERT(worker < kMaxThreads);
+  DEBUG_ASSERT(n > 0);
+  DEBUG_ASSERT(max <= std::numeric_limits<uint32_t>::max());
+
+  if (auto r = takeOwn(worker, n); r.first < r.second)
+    return r;
+  if (const size_t nodes = mShards.size(); nodes != 0) {
+    const size_t home = std::min(node, nodes - 1);
+    const size_t nodeWorkers = std::max<size_t>(mWorkers / nodes, 1);
+    for (size_t i = 0; i < nodes; ++i) {
+      Shard& shard = mShards[(home + i) % nodes];
+      if (auto r = claim(worker, n, shard.mNext, shard.mEnd, nodeWorkers); r.first < r.second)
+        return r;
+    }
+  }
+  if (auto r = claim(worker, n, mIndex, max, mWorkers); r.first < r.second)
+    return r;
+  return steal(worker, n);
+}
+
+void ItemQueue::shard(const std::vector<size_t>& bounds)
+{
+  DEBUG_ASSERT(bounds.size() >= 2);
+  mShards = std::vector<Shard>(bounds.size() - 1);
+  for (size_t i = 0; i < mShards.size(); ++i) {
+    Shard& shard = mShards[i];
+    shard.mBegin = std::max(bounds[i], mStart);
+    shard.mEnd = std::max(bounds[i + 1], mStart);
+    shard.mNext.store(shard.mBegin, std::memory_order_relaxed);
+  }
+  mTailStart = std::max(bounds.back(), mStart);
+  mIndex.store(mTailStart, std::memory_order_relaxed);
+}
+
+std::pair<size_t, size_t> ItemQueue::takeOwn(size_t worker, size_t n) noexcept
+{
+  auto& range = mRanges[worker].mValue;
+  uint64_t expected = range.load(std::memory_order_relaxed);
+  uint64_t desired; // NOLINT(cppcoreguidelines-init-variables)
+  do {
+    if (begin(expected) >= end(expected))
+      return {};
+    desired = pack(std::min(begin(expected) + n, end(expected)), end(expected));
+  } while (!range.compare_exchange_weak(expected, desired, std::memory_order_relaxed,
+                                        std::memory_order_relaxed));
+  return { begin(expected), begin(desired) };
+}
+
+std::pair<size_t, size_t> ItemQueue::claim(
+    size_t worker, size_t n, std::atomic<size_t>& next, size_t max, size_t workers) noexcept
+{
+  size_t expected = next.load(std::memory_order_relaxed);
+  size_t desired; // NOLINT(cppcoreguidelines-init-variables)
+  do {
+    if (expected >= max)
+      return {};
+    // Guided self-scheduling, a share of what's left that shrinks along with it.
+    const size_t size = std::max(n, (max - expected) / (workers * 2));
+    desired = std::min(expected + size, max);
+  } while (!next.compare_exchange_weak(expected, desired, std::memory_order_relaxed,
+                                       std::memory_order_relaxed));
+
+  // Nobody else writes an empty range, so it can be replaced without a CAS. Thieves that loaded
+  // the previous range fail their CAS, ranges are never claimed twice.
+  const size_t end = std::min(expected + n, desired);
+  mRanges[worker].mValue.store(pack(end, desired), std::memory_order_relaxed);
+  return { expected, end };
+}
+
+std::pair<size_t, size_t> ItemQueue::steal(size_t worker, size_t n) noexcept
+{
+  // Workers past the expected count can still show up, if the count changed before they started.
+  const size_t workers = std::max(mWorkers, worker + 1);
+  for (size_t i = 1; i < workers; ++i) {
+    auto& range = mRanges[(worker + i) % workers].mValue;
+    uint64_t expected = range.load(std::memory_order_relaxed);
+    uint64_t desired; // NOLINT(cppcoreguidelines-init-variables)
+    size_t mid; // NOLINT(cppcoreguidelines-init-variables)
+    do {
+      if (begin(expected) >= end(expected))
+        break;
+      // Leave the victim the front half, it might be in the middle of taking from it.
+      mid = begin(expected) + (end(expected) - begin(expected)) / 2;
+      desired = pack(begin(expected), mid);
+    } while (!range.compare_exchange_weak(expected, desired, std::memory_order_relaxed,
+                                          std::memory_order_relaxed));
+    if (begin(expected) >= end(expected))
+      continue;
+
+    const size_t stop = std::min(mid + n, end(expected));
+    mRanges[worker].mValue.store(pack(stop, end(expected)), std::memory_order_relaxed);
+    return { mid, stop };
+  }
+  return {};
+}
+
+size_t ItemQueue::get() const noexcept
+{
+  // Whatever is still left in the ranges isn't processed yet.
+  size_t reserved = mStart + mIndex.load(std::memory_order_relaxed) - mTailStart;
+  for (const Shard& shard : mShards)
+    reserved += shard.mNext.load(std::memory_order_relaxed) - shard.mBegin;
+  for (size_t i = 0; i < kMaxThreads; ++i) {
+    const uint64_t range = mRanges[i].mValue.load(std::memory_order_relaxed);
+    if (begin(range) < end(range))
+      reserved -= std::min(reserved, end(range) - begin(range));
+  }
+  return reserved;
+}
+
+} // namespace fzx
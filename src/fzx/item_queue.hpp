@@ -2,46 +2,85 @@
 
 #pragma once
 
-#include <algorithm>
+#include <array>
 #include <atomic>
 #include <cstddef>
+#include <cstdint>
 #include <utility>
+#include <vector>
 
 #include "fzx/config.hpp"
 
 namespace fzx {
 
-/// Atomic counter for adding queue functionality on top of fzx::Items
+/// Work queue for adding queue functionality on top of fzx::Items
+///
+/// Every worker owns a range of items and takes chunks from its front. When the range runs out,
+/// the worker claims a new range from the shared tail of the queue. Ranges get smaller as fewer
+/// items are left, so the last of them can be spread across the workers. Once the tail is empty
+/// too, the worker steals the back half of the range of some other worker.
+///
+/// This way the workers mostly touch only their own cache line, and nobody is left processing
+/// a long range alone at the end.
+///
+/// With NUMA, the items can be split into shards placed on different nodes. Workers claim ranges
+/// from the shard of their own node first, and help with the other shards only after that.
 struct ItemQueue
 {
-  // This atomic counter is not synchronizing anything, hence the relaxed atomics.
+  // This queue is not synchronizing anything, hence the relaxed atomics. Each range is a single
+  // atomic word, so the owner and thieves taking from it at once are resolved with a CAS.
 
-  /// Reserve `n` items and return the start index of reserved range.
-  [[nodiscard]] size_t take(size_t n) noexcept
+  /// Queue for about `workers` workers, starting at `index`, when the items before it don't have
+  /// to be processed.
+  explicit ItemQueue(size_t workers, size_t index = 0) noexcept;
+
+  /// Reserve up to `n` items for `worker`, up to `max` items, and return the reserved range.
+  /// An empty range is returned when everything up to `max` is reserved. The queue never goes
+  /// past `max`, so it can be resumed when `max` grows. The worker runs on NUMA node `node`, the
+  /// shard of that node is claimed from first.
+  [[nodiscard]] std::pair<size_t, size_t>
+  take(size_t worker, size_t n, size_t max, size_t node = 0) noexcept;
+
+  /// Split the items into shards, items [bounds[k], bounds[k + 1]) for node k, as placed by
+  /// Items::bindToNode. Items past the last shard aren't on any node. Has to be called before the
+  /// queue is shared.
+  void shard(const std::vector<size_t>& bounds);
+
+  /// Get the number of items reserved so far, for reporting the progress.
+  [[nodiscard]] size_t get() const noexcept;
+
+private:
+  /// Range of items packed into a single word, the start in the low 32 bits.
+  struct alignas(kCacheLine) Range
   {
-    return mIndex.fetch_add(n, std::memory_order_relaxed);
-  }
+    std::atomic<uint64_t> mValue { 0 };
+  };
 
-  /// Reserve `n` items, up to `max` items, and return the reserved range.
-  /// unused atm
-  [[nodiscard]] std::pair<size_t, size_t> take(size_t n, size_t max) noexcept
+  /// Take up to `n` items from the front of the range of `worker`.
+  [[nodiscard]] std::pair<size_t, size_t> takeOwn(size_t worker, size_t n) noexcept;
+  /// Items of a node, claimed the same way as the tail.
+  struct alignas(kCacheLine) Shard
   {
-    size_t expected = mIndex.load(std::memory_order_relaxed);
-    size_t desired; // NOLINT(cppcoreguidelines-init-variables)
-    do {
-      desired = std::min(expected + n, max);
-      if (desired == max)
-        return { 0, 0 };
-    } while (!mIndex.compare_exchange_weak(expected, expected + n, std::memory_order_relaxed,
-                                           std::memory_order_relaxed));
-    return { expected, desired };
-  }
-
-  /// Get the current value, for reporting the progress.
-  [[nodiscard]] size_t get() const noexcept { return mIndex.load(std::memory_order_relaxed); }
+    std::atomic<size_t> mNext { 0 };
+    size_t mBegin { 0 };
+    size_t mEnd { 0 };
+  };
 
-private:
+  /// Claim a range of items from `next` up to `max`, shared by about `workers` workers, and take
+  /// up to `n` items from it.
+  [[nodiscard]] std::pair<size_t, size_t>
+  claim(size_t worker, size_t n, std::atomic<size_t>& next, size_t max, size_t workers) noexcept;
+  /// Steal the back half of the range of another worker and take up to `n` items from it.
+  [[nodiscard]] std::pair<size_t, size_t> steal(size_t worker, size_t n) noexcept;
+
+  std::array<Range, kMaxThreads> mRanges;
+  /// Start of the items not owned by any worker yet, past the shards.
   alignas(kCacheLine) std::atomic<size_t> mIndex { 0 };
+  std::vector<Shard> mShards;
+  /// Where the queue started, and where the tail started.
+  size_t mStart { 0 };
+  size_t mTailStart { 0 };
+  size_t mWorkers { 1 };
 };
 
 } // namespace fzx
@@ -11,6 +11,9 @@
 
 #include "fzx/config.hpp"
 #include "fzx/macros.hpp"
+#include "fzx/numa.hpp"
+#include "fzx/strings.hpp"
+#include "fzx/unicode.hpp"
 #include "fzx/util.hpp"
 
 namespace fzx {
@@ -19,12 +22,20 @@ using Offset = uint64_t;
 
 namespace {
 
+/// Element of the items array
+struct Entry
+{
+  Offset mOffset;
+  uint64_t mCharMask;
+};
+
 // 38 bits for offset - 256GB addressable (can be compacted, strings are aligned)
 constexpr Offset kItemOffsetMask = 0x3FFFFFFFFFULL;
 // 25 bits for size - max 32MB per string
 constexpr Offset kItemSizeMask = 0x1FFFFFFULL;
 constexpr auto kItemSizeShift = 38;
-// 1 bit reserved for ASCII/Unicode
+// 1 bit for strings with non-ASCII characters
+constexpr Offset kItemUnicode = Offset { 1 } << 63;
 
 } // namespace
 
@@ -71,7 +82,7 @@ void Items::clear() noexcept
 std::string_view Items::at(size_t n) const noexcept
 {
   DEBUG_ASSERT(n < mItemsSize);
-  Offset item = *std::launder(reinterpret_cast<const Offset*>(mItems.data()) + n);
+  Offset item = std::launder(reinterpret_cast<const Entry*>(mItems.data()) + n)->mOffset;
   Offset offset = item & kItemOffsetMask;
   Offset size = (item >> kItemSizeShift) & kItemSizeMask;
 
@@ -79,12 +90,25 @@ std::string_view Items::at(size_t n) const noexcept
   return { reinterpret_cast<const char*>(mStrs.data()) + offset, size };
 }
 
+uint64_t Items::charMask(size_t n) const noexcept
+{
+  DEBUG_ASSERT(n < mItemsSize);
+  return std::launder(reinterpret_cast<const Entry*>(mItems.data()) + n)->mCharMask;
+}
+
+bool Items::isAscii(size_t n) const noexcept
+{
+  DEBUG_ASSERT(n < mItemsSize);
+  return (std::launder(reinterpret_cast<const Entry*>(mItems.data()) + n)->mOffset & kItemUnicode)
+      == 0;
+}
+
 void Items::push(std::string_view s)
 {
   if (s.empty())
     return;
 
-  uint8_t* ptr = allocItem(s.size());
+  uint8_t* ptr = allocItem(s.size(), fzx::charMask(s), fzx::isAscii(s));
   std::memset(ptr, 0, roundUp<16>(s.size())); // TODO: memset only the bytes that are left
   std::memcpy(ptr, s.data(), s.size());
 
@@ -92,7 +116,52 @@ void Items::push(std::string_view s)
     mMaxStrSize = s.size();
 }
 
-uint8_t* Items::allocItem(size_t bytes)
+void Items::mapFile(const char* path, char delimiter)
+{
+  if (mItemsSize != 0)
+    throw std::logic_error { "items are not empty" };
+
+  // Padding of the last item, and what can be read past it
+  size_t size = 0;
+  auto mem = RcMem::mapFile(path, 16 + kOveralloc, size);
+  if (size > kItemOffsetMask)
+    throw std::length_error { "file is too big" };
+
+  // Build everything in a copy first, in case there's an item that's too big
+  Items r;
+  const auto* data = reinterpret_cast<const char*>(mem.data());
+  for (size_t pos = 0; pos < size;) {
+    const auto* it = static_cast<const char*>(std::memchr(data + pos, delimiter, size - pos));
+    const size_t end = it != nullptr ? static_cast<size_t>(it - data) : size;
+    if (const std::string_view s { data + pos, end - pos }; !s.empty()) {
+      if (s.size() > kItemSizeMask)
+        throw std::length_error { "item is too big" };
+      r.appendItem(pos, s.size(), fzx::charMask(s), fzx::isAscii(s));
+      if (s.size() > r.mMaxStrSize)
+        r.mMaxStrSize = s.size();
+    }
+    pos = end + 1;
+  }
+
+  r.mStrs = std::move(mem);
+  r.mStrsSize = roundUp<16>(size);
+  r.mStrsCap = 0; // Mapped memory is read-only, the next push has to copy it
+  *this = std::move(r);
+}
+
+void Items::bindToNode(size_t begin, size_t end, size_t node) const noexcept
+{
+  DEBUG_ASSERT(begin <= end && end <= mItemsSize);
+  if (begin == end)
+    return;
+  const auto* items = std::launder(reinterpret_cast<const Entry*>(mItems.data()));
+  const Offset strsBegin = items[begin].mOffset & kItemOffsetMask;
+  const Offset strsEnd = end < mItemsSize ? items[end].mOffset & kItemOffsetMask : mStrsSize;
+  bindMemory(mStrs.data() + strsBegin, strsEnd - strsBegin, node);
+  bindMemory(items + begin, (end - begin) * sizeof(Entry), node);
+}
+
+uint8_t* Items::allocItem(size_t bytes, uint64_t charMask, bool ascii)
 {
   DEBUG_ASSERT(bytes > 0);
 
@@ -119,9 +188,6 @@ uint8_t* Items::allocItem(size_t bytes)
   constexpr auto kAlign = 16;
   DEBUG_ASSERT(isMulOf<kAlign>(mStrsSize));
 
-  const size_t itemsSize = mItemsSize + 1;
-  if (itemsSize > kItemOffsetMask)
-    throw std::length_error { "max item count reached" };
   const size_t strsSize = mStrsSize + roundUp<kAlign>(bytes);
 
   // Resize the string array
@@ -138,14 +204,27 @@ uint8_t* Items::allocItem(size_t bytes)
     mStrsCap = cap;
   }
 
+  // Save item string pointer
+  uint8_t* ptr = mStrs.data() + mStrsSize;
+  appendItem(mStrsSize, bytes, charMask, ascii);
+  mStrsSize = strsSize;
+  return ptr;
+}
+
+void Items::appendItem(size_t offset, size_t bytes, uint64_t charMask, bool ascii)
+{
+  const size_t itemsSize = mItemsSize + 1;
+  if (itemsSize > kItemOffsetMask)
+    throw std::length_error { "max item count reached" };
+
   // Resize the item array
   if (itemsSize > mItemsCap) {
     size_t cap = mItemsCap == 0 ? 512 : mItemsCap * 2;
-    auto mem = RcMem::create(cap * sizeof(Offset));
+    auto mem = RcMem::create(cap * sizeof(Entry));
 
     if (mItemsSize != 0) {
-      const auto* src = std::launder(reinterpret_cast<const Offset*>(mItems.data()));
-      auto* dst = std::launder(reinterpret_cast<Offset*>(mem.data()));
+      const auto* src = std::launder(reinterpret_cast<const Entry*>(mItems.data()));
+      auto* dst = std::launder(reinterpret_cast<Entry*>(mem.data()));
       std::uninitialized_copy_n(src, mItemsSize, dst);
     }
 
@@ -153,15 +232,10 @@ uint8_t* Items::allocItem(size_t bytes)
     mItemsCap = cap;
   }
 
-  // Save item string pointer
-  uint8_t* ptr = mStrs.data() + mStrsSize;
   // Append item offset to the items array
-  new (mItems.data() + mItemsSize * sizeof(Offset))
-      Offset { mStrsSize | (bytes << kItemSizeShift) };
-  // Update current array sizes
-  mStrsSize = strsSize;
+  new (mItems.data() + mItemsSize * sizeof(Entry))
+      Entry { offset | (bytes << kItemSizeShift) | (ascii ? 0 : kItemUnicode), charMask };
   mItemsSize = itemsSize;
-  return ptr;
 }
 
 } // namespace fzx
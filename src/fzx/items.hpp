@@ -3,6 +3,7 @@
 #pragma once
 
 #include <cstddef>
+#include <cstdint>
 #include <string_view>
 
 #include "fzx/rc_mem.hpp"
@@ -33,21 +34,49 @@ struct Items
   /// NOTE: Accessing an item out of range is undefined behavior.
   [[nodiscard]] std::string_view at(size_t n) const noexcept;
 
+  /// Get the set of characters of the item at given index, see fzx::charMask. It is calculated
+  /// once, when the item is pushed, so items can be rejected without looking at the string.
+  ///
+  /// NOTE: Accessing an item out of range is undefined behavior.
+  [[nodiscard]] uint64_t charMask(size_t n) const noexcept;
+
+  /// Check if the item at given index has only ASCII characters, see fzx::isAscii. Like the
+  /// character mask, it is saved when the item is pushed.
+  ///
+  /// NOTE: Accessing an item out of range is undefined behavior.
+  [[nodiscard]] bool isAscii(size_t n) const noexcept;
+
   /// Push a new string into the vector.
   ///
   /// NOTE: Internal storage is shared between the copies. Only the most up-to-date
   /// copy can call this method. Otherwise it's undefined behavior (data race).
   void push(std::string_view s);
 
+  /// Map a file into memory and use its lines, separated by `delimiter`, as the items. Only the
+  /// offsets of the lines are stored, the strings are not copied and are not aligned.
+  ///
+  /// Items have to be empty. Pushing an item afterwards copies the whole file into memory.
+  /// Throws std::system_error if the file can't be mapped.
+  void mapFile(const char* path, char delimiter = '\n');
+
   [[nodiscard]] size_t maxStrSize() const noexcept { return mMaxStrSize; }
 
+  /// Place the memory of items [begin, end) on NUMA node `node`, see fzx::bindMemory.
+  void bindToNode(size_t begin, size_t end, size_t node) const noexcept;
+
+  /// Get the address of the string storage. It changes when the storage is reallocated, which
+  /// loses the placement set by bindToNode.
+  [[nodiscard]] const void* storage() const noexcept { return mStrs ? mStrs.data() : nullptr; }
+
 private:
   /// Allocate space for new item, append it to the items array and return the item base pointer
-  uint8_t* allocItem(size_t bytes);
+  uint8_t* allocItem(size_t bytes, uint64_t charMask, bool ascii);
+  /// Append item at `offset` in the string storage to the items array
+  void appendItem(size_t offset, size_t bytes, uint64_t charMask, bool ascii);
 
 private:
   RcMem mStrs; ///< Item storage
-  RcMem mItems; ///< Item offsets, for random access
+  RcMem mItems; ///< Item offsets and character masks, for random access
   size_t mStrsSize { 0 };
   size_t mItemsSize { 0 };
   size_t mStrsCap { 0 };
@@ -6,6 +6,10 @@
 #include "fzx/macros.hpp"
 
 #include <algorithm>
+#include <cstring>
+#include <string>
+#include <utility>
+#include <vector>
 
 extern "C" {
 #include <lua.h>
@@ -14,11 +18,44 @@ extern "C" {
 
 namespace fzx::lua {
 
+/// Result in ResultsBuffer.
+struct ResultsRow
+{
+  uint32_t mIndex;
+  float mScore;
+  uint32_t mTextBegin; ///< Text of the item is [mTextBegin, mTextEnd) in ResultsBuffer::mText
+  uint32_t mTextEnd;
+  uint32_t mRangesBegin; ///< Matched ranges are [mRangesBegin, mRangesEnd) in mRanges
+  uint32_t mRangesEnd;
+};
+
+/// Window of results written by getResultsBuffer, meant to be read with LuaJIT FFI instead of
+/// creating tables for every row. The layout has to match the declarations in
+/// lua/fzx/results.lua.
+struct ResultsBuffer
+{
+  uint32_t mTotal;
+  uint32_t mMatched;
+  uint32_t mOffset;
+  uint32_t mSize; ///< Number of rows
+  float mProgress;
+  bool mProcessing;
+  const ResultsRow* mRows;
+  const MatchRange* mRanges;
+  const char* mText;
+};
+
 struct Instance
 {
   EventFd mEventFd;
   LineScanner mLineScanner;
   Fzx mFzx;
+
+  // Reused by every getResultsBuffer call
+  ResultsBuffer mResults {};
+  std::vector<ResultsRow> mResultsRows;
+  std::vector<MatchRange> mResultsRanges;
+  std::string mResultsText;
 };
 
 static constexpr const char* kMetatable = "fzx-instance";
@@ -28,19 +65,55 @@ static Instance*& getUserdata(lua_State* lstate)
   return *static_cast<Instance**>(luaL_checkudata(lstate, 1, kMetatable));
 }
 
+/// Read the number of threads at `index`, either a number or 'auto', see Fzx::setThreads.
+static bool getThreads(lua_State* lstate, int index, unsigned& threads)
+{
+  if (lua_type(lstate, index) == LUA_TNUMBER) {
+    threads = static_cast<unsigned>(
+        std::clamp(lua_tointeger(lstate, index), lua_Integer { 1 }, lua_Integer { kMaxThreads }));
+    return true;
+  }
+  if (lua_type(lstate, index) == LUA_TSTRING
+      && std::strcmp(lua_tostring(lstate, index), "auto") == 0) {
+    threads = 0;
+    return true;
+  }
+  return false;
+}
+
 static int create(lua_State* lstate)
 {
   unsigned threads = 1;
+  size_t limit = 0;
+  CaseMode caseMode = CaseMode::kInsensitive;
   if (!lua_isnil(lstate, 1)) {
     if (!lua_istable(lstate, 1))
       return luaL_error(lstate, "fzx: expected table");
 
     lua_getfield(lstate, 1, "threads");
+    if (!lua_isnil(lstate, -1) && !getThreads(lstate, -1, threads))
+      return luaL_error(lstate, "fzx: 'threads' has to be a number or 'auto'");
+    lua_pop(lstate, 1);
+
+    lua_getfield(lstate, 1, "limit");
     if (!lua_isnil(lstate, -1)) {
       if (lua_type(lstate, -1) != LUA_TNUMBER)
-        return luaL_error(lstate, "fzx: 'threads' has to be a number");
-      threads =
-          std::clamp(lua_tointeger(lstate, -1), lua_Integer { 1 }, lua_Integer { kMaxThreads });
+        return luaL_error(lstate, "fzx: 'limit' has to be a number");
+      limit = static_cast<size_t>(std::max(lua_tointeger(lstate, -1), lua_Integer { 0 }));
+    }
+    lua_pop(lstate, 1);
+
+    lua_getfield(lstate, 1, "case");
+    if (!lua_isnil(lstate, -1)) {
+      const char* str = lua_type(lstate, -1) == LUA_TSTRING ? lua_tostring(lstate, -1) : "";
+      if (std::strcmp(str, "insensitive") == 0)
+        caseMode = CaseMode::kInsensitive;
+      else if (std::strcmp(str, "sensitive") == 0)
+        caseMode = CaseMode::kSensitive;
+      else if (std::strcmp(str, "smart") == 0)
+        caseMode = CaseMode::kSmart;
+      else
+        return luaL_error(lstate, "fzx: 'case' has to be 'insensitive', 'sensitive' or 'smart'");
     }
     lua_pop(lstate, 1);
   }
@@ -49,6 +122,8 @@ static int create(lua_State* lstate)
   try {
     p = new Instance();
     p->mFzx.setThreads(threads);
+    p->mFzx.setResultsLimit(limit);
+    p->mFzx.setCaseMode(caseMode);
     if (auto err = p->mEventFd.open(); !err.empty())
       return luaL_error(lstate, "fzx: %s", err.c_str());
     p->mFzx.setCallback([](void* userData) { static_cast<Instance*>(userData)->mEventFd.notify(); },
@@ -146,6 +221,19 @@ try {
   return luaL_error(lstate, "fzx: %s", e.what());
 }
 
+static int loadFile(lua_State* lstate)
+try {
+  auto* p = getUserdata(lstate);
+  if (p == nullptr)
+    return luaL_error(lstate, "fzx: null pointer");
+  const char* path = luaL_checkstring(lstate, 2);
+  p->mFzx.loadFile(path);
+  p->mFzx.commit();
+  return 0;
+} catch (const std::exception& e) {
+  return luaL_error(lstate, "fzx: %s", e.what());
+}
+
 static int scanFeed(lua_State* lstate)
 try {
   auto* p = getUserdata(lstate);
@@ -198,6 +286,21 @@ try {
   return luaL_error(lstate, "fzx: %s", e.what());
 }
 
+static int setThreads(lua_State* lstate)
+try {
+  auto* p = getUserdata(lstate);
+  if (p == nullptr)
+    return luaL_error(lstate, "fzx: null pointer");
+  unsigned threads = 1;
+  if (!getThreads(lstate, 2, threads))
+    return luaL_error(lstate, "fzx: 'threads' has to be a number or 'auto'");
+  p->mFzx.setThreads(threads);
+  p->mFzx.commit();
+  return 0;
+} catch (const std::exception& e) {
+  return luaL_error(lstate, "fzx: %s", e.what());
+}
+
 static int loadResults(lua_State* lstate)
 {
   auto* p = getUserdata(lstate);
@@ -208,11 +311,9 @@ static int loadResults(lua_State* lstate)
   return 1;
 }
 
-static int getResults(lua_State* lstate)
-try {
-  auto* p = getUserdata(lstate);
-  if (p == nullptr)
-    return luaL_error(lstate, "fzx: null pointer");
+/// Results [offset, end) requested with the `max` and `offset` arguments at indexes 2 and 3.
+static std::pair<size_t, size_t> getResultsWindow(lua_State* lstate, Instance* p)
+{
   lua_settop(lstate, 3);
 
   lua_Integer max = 50;
@@ -232,7 +333,27 @@ try {
   const auto maxoff = size > static_cast<size_t>(max) ? size - static_cast<size_t>(max) : 0;
   if (static_cast<size_t>(offset) > maxoff)
     offset = static_cast<lua_Integer>(maxoff);
-  const auto end = std::min(static_cast<size_t>(offset) + static_cast<size_t>(max), size);
+  auto end = std::min(static_cast<size_t>(offset) + static_cast<size_t>(max), size);
+  // Results past the limit are not there yet, request them and return what we have for now.
+  p->mFzx.reserveResults(end);
+  end = std::min(end, p->mFzx.availableResults());
+  return { static_cast<size_t>(offset), std::max(end, static_cast<size_t>(offset)) };
+}
+
+static int getResults(lua_State* lstate)
+try {
+  auto* p = getUserdata(lstate);
+  if (p == nullptr)
+    return luaL_error(lstate, "fzx: null pointer");
+
+  // Options at index 4. `ranges` returns matched ranges instead of positions.
+  bool withRanges = false;
+  if (lua_istable(lstate, 4)) {
+    lua_getfield(lstate, 4, "ranges");
+    withRanges = lua_toboolean(lstate, -1);
+    lua_pop(lstate, 1);
+  }
+  const auto [offset, end] = getResultsWindow(lstate, p);
 
   const Query* query = p->mFzx.query();
 
@@ -244,7 +365,7 @@ try {
   lua_pushinteger(lstate, static_cast<lua_Integer>(p->mFzx.resultsSize()));
   lua_setfield(lstate, -2, "matched");
 
-  lua_pushinteger(lstate, offset);
+  lua_pushinteger(lstate, static_cast<lua_Integer>(offset));
   lua_setfield(lstate, -2, "offset");
 
   lua_pushboolean(lstate, p->mFzx.processing());
@@ -253,8 +374,10 @@ try {
   lua_pushnumber(lstate, p->mFzx.progress());
   lua_setfield(lstate, -2, "progress");
 
-  lua_createtable(lstate, static_cast<int>(max), 0);
+  lua_createtable(lstate, static_cast<int>(end - offset), 0);
   const int tableSize = query && query->empty() ? 3 : 4;
+  std::vector<MatchRange> ranges;
+  std::vector<bool> positions;
   int n = 1;
   for (size_t i = offset; i < end; ++i, ++n) {
     auto item = p->mFzx.getResult(i);
@@ -266,17 +389,31 @@ try {
     lua_pushlstring(lstate, item.mLine.data(), item.mLine.size());
     lua_setfield(lstate, -2, "text");
 
-    lua_createtable(lstate, static_cast<int>(item.mLine.size()), 0);
-    if (query && !query->empty()) {
-      std::vector<bool> positions;
-      positions.reserve(p->mFzx.maxStrSize());
-      query->matchPositions(item.mLine, positions);
-      for (int i = 0; i < static_cast<int>(positions.size()); ++i) {
-        lua_pushboolean(lstate, positions[i]);
-        lua_rawseti(lstate, -2, i + 1);
+    if (withRanges) {
+      // Matched ranges of bytes, flattened to begin and end pairs. Columns start at 0 and ends
+      // are exclusive, same as extmark columns.
+      ranges.clear();
+      if (query && !query->empty())
+        query->matchRanges(item.mLine, ranges);
+      lua_createtable(lstate, static_cast<int>(ranges.size() * 2), 0);
+      for (size_t k = 0; k < ranges.size(); ++k) {
+        lua_pushinteger(lstate, ranges[k].mBegin);
+        lua_rawseti(lstate, -2, static_cast<int>((k * 2) + 1));
+        lua_pushinteger(lstate, ranges[k].mEnd);
+        lua_rawseti(lstate, -2, static_cast<int>((k * 2) + 2));
+      }
+      lua_setfield(lstate, -2, "ranges");
+    } else {
+      lua_createtable(lstate, static_cast<int>(item.mLine.size()), 0);
+      if (query && !query->empty()) {
+        query->matchPositions(item.mLine, positions);
+        for (int k = 0; k < static_cast<int>(positions.size()); ++k) {
+          lua_pushboolean(lstate, positions[k]);
+          lua_rawseti(lstate, -2, k + 1);
+        }
       }
+      lua_setfield(lstate, -2, "positions");
     }
-    lua_setfield(lstate, -2, "positions");
 
     lua_pushnumber(lstate, item.mScore);
     lua_setfield(lstate, -2, "score");
@@ -289,6 +426,53 @@ try {
   return luaL_error(lstate, "fzx: %s", e.what());
 }
 
+/// Same as getResults, but the results are written to a buffer that is reused by every call,
+/// see ResultsBuffer. Returns a light userdata pointing to it, valid until the next call.
+static int getResultsBuffer(lua_State* lstate)
+try {
+  auto* p = getUserdata(lstate);
+  if (p == nullptr)
+    return luaL_error(lstate, "fzx: null pointer");
+  const auto [offset, end] = getResultsWindow(lstate, p);
+
+  const Query* query = p->mFzx.query();
+  auto& rows = p->mResultsRows;
+  auto& ranges = p->mResultsRanges;
+  auto& text = p->mResultsText;
+  rows.clear();
+  ranges.clear();
+  text.clear();
+  for (size_t i = offset; i < end; ++i) {
+    auto item = p->mFzx.getResult(i);
+    ResultsRow& row = rows.emplace_back();
+    row.mIndex = item.mIndex;
+    row.mScore = item.mScore;
+    // Items can be moved by pushItem, so the text is copied, the buffer has to stay valid
+    row.mTextBegin = static_cast<uint32_t>(text.size());
+    text.append(item.mLine);
+    row.mTextEnd = static_cast<uint32_t>(text.size());
+    row.mRangesBegin = static_cast<uint32_t>(ranges.size());
+    if (query && !query->empty())
+      query->matchRanges(item.mLine, ranges);
+    row.mRangesEnd = static_cast<uint32_t>(ranges.size());
+  }
+
+  ResultsBuffer& r = p->mResults;
+  r.mTotal = static_cast<uint32_t>(p->mFzx.itemsSize());
+  r.mMatched = static_cast<uint32_t>(p->mFzx.resultsSize());
+  r.mOffset = static_cast<uint32_t>(offset);
+  r.mSize = static_cast<uint32_t>(rows.size());
+  r.mProgress = static_cast<float>(p->mFzx.progress());
+  r.mProcessing = p->mFzx.processing();
+  r.mRows = rows.data();
+  r.mRanges = ranges.data();
+  r.mText = text.data();
+  lua_pushlightuserdata(lstate, &r);
+  return 1;
+} catch (const std::exception& e) {
+  return luaL_error(lstate, "fzx: %s", e.what());
+}
+
 } // namespace fzx::lua
 
 // NOLINTNEXTLINE(readability-identifier-naming)
@@ -300,7 +484,7 @@ extern "C" EXPORT int luaopen_fzxlua(lua_State* lstate)
       lua_setfield(lstate, -2, "__gc");
     lua_pushcfunction(lstate, fzx::lua::toString);
       lua_setfield(lstate, -2, "__tostring");
-    lua_createtable(lstate, 0, 10);
+    lua_createtable(lstate, 0, 14);
       lua_pushcfunction(lstate, fzx::lua::isNil);
         lua_setfield(lstate, -2, "is_nil");
       lua_pushcfunction(lstate, fzx::lua::getFd);
@@ -311,6 +495,8 @@ extern "C" EXPORT int luaopen_fzxlua(lua_State* lstate)
         lua_setfield(lstate, -2, "stop");
       lua_pushcfunction(lstate, fzx::lua::push);
         lua_setfield(lstate, -2, "push");
+      lua_pushcfunction(lstate, fzx::lua::loadFile);
+        lua_setfield(lstate, -2, "load_file");
       lua_pushcfunction(lstate, fzx::lua::scanFeed);
         lua_setfield(lstate, -2, "scan_feed");
       lua_pushcfunction(lstate, fzx::lua::scanEnd);
@@ -319,10 +505,14 @@ extern "C" EXPORT int luaopen_fzxlua(lua_State* lstate)
         lua_setfield(lstate, -2, "commit");
       lua_pushcfunction(lstate, fzx::lua::setQuery);
         lua_setfield(lstate, -2, "set_query");
+      lua_pushcfunction(lstate, fzx::lua::setThreads);
+        lua_setfield(lstate, -2, "set_threads");
       lua_pushcfunction(lstate, fzx::lua::loadResults);
         lua_setfield(lstate, -2, "load_results");
       lua_pushcfunction(lstate, fzx::lua::getResults);
         lua_setfield(lstate, -2, "get_results");
+      lua_pushcfunction(lstate, fzx::lua::getResultsBuffer);
+        lua_setfield(lstate, -2, "get_results_buffer");
       lua_setfield(lstate, -2, "__index");
     lua_pop(lstate, 1);
 
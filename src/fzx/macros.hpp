@@ -23,6 +23,17 @@
 # define NOINLINE
 #endif
 
+// Compile a function for a specific instruction set, regardless of the global compiler flags.
+// Kernels that are selected at runtime need it, see FZX_DISPATCH. FLATTEN inlines everything
+// into the function, so shared kernel code gets compiled for its instruction set as well.
+#if defined(__GNUC__) || defined(__clang__)
+# define TARGET(x) __attribute__((target(x)))
+# define FLATTEN __attribute__((flatten))
+#else
+# define TARGET(x)
+# define FLATTEN
+#endif
+
 #if defined(_MSC_VER)
 # define RESTRICT __restrict
 #elif defined(__GNUC__) || defined(__clang__)
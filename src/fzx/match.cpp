@@ -5,6 +5,7 @@
 #include <cstdint>
 
 #include "fzx/config.hpp"
+#include "fzx/cpu.hpp"
 #include "fzx/macros.hpp"
 #include "fzx/simd.hpp"
 #include "fzx/strings.hpp"
@@ -14,14 +15,25 @@ namespace fzx {
 
 namespace {
 
+// Every kernel has a case sensitive and a case insensitive version. The sensitive ones compare
+// the bytes as they are, without folding them first.
+
+template <bool kCaseSensitive>
+constexpr char fold(char ch) noexcept
+{
+  return kCaseSensitive ? ch : static_cast<char>(toLower(ch));
+}
+
+template <bool kCaseSensitive>
 [[maybe_unused]] bool matchFuzzyNaive(const AlignedString& needle,
                                       std::string_view haystack) noexcept
 {
   const char* it = haystack.data();
   const char* const end = it + haystack.size();
   for (char ch : needle) {
-    char uch = static_cast<char>(toUpper(ch));
-    while (it != end && *it != ch && *it != uch)
+    const char lch = fold<kCaseSensitive>(ch);
+    const char uch = kCaseSensitive ? ch : static_cast<char>(toUpper(lch));
+    while (it != end && *it != lch && *it != uch)
       ++it;
     if (it == end)
       return false;
@@ -30,13 +42,16 @@ namespace {
   return true;
 }
 
+// Items don't have to be aligned or padded with zeros, the bytes that follow can belong to the
+// next item. So the kernels load unaligned and mask out everything past the haystack. Reading
+// past the haystack is safe thanks to kOveralloc.
+
 #if defined(FZX_SSE2)
 // TODO: port to neon
+template <bool kCaseSensitive>
 [[maybe_unused]] bool matchFuzzySSE(const AlignedString& needle, std::string_view haystack) noexcept
 {
-  // TODO: haystack is padded with zeros. if needle includes zeros, it can match those.
-  //       i think it's best to just ban zeros from queries.
-  constexpr auto kAlign = 16;
+  constexpr auto kWidth = 16;
 
   const char* ndIt = needle.data();
   const char* const ndEnd = ndIt + needle.size();
@@ -44,151 +59,427 @@ namespace {
     return true;
 
   const char* hsIt = haystack.data();
-  DEBUG_ASSERT(isAligned<kAlign>(hsIt));
-  const char* const hsEnd = hsIt + roundUp<kAlign>(haystack.size());
+  const char* const hsEnd = hsIt + haystack.size();
   if (hsIt == hsEnd)
     return false;
 
+  // Mask of positions in the current chunk that are a part of the haystack
+  auto validMask = [&]() -> uint32_t {
+    const auto left = hsEnd - hsIt;
+    return left >= kWidth ? 0xFFFF : (uint32_t { 1 } << left) - 1;
+  };
+
   // Initial state of registers
-  auto hs = simd::toLower(_mm_load_si128(reinterpret_cast<const __m128i*>(hsIt)));
-  auto nd = _mm_set1_epi8(static_cast<char>(toLower(*ndIt)));
-  uint32_t pos = 0; // Current position in a 16-byte chunk
+  auto hs = _mm_loadu_si128(reinterpret_cast<const __m128i*>(hsIt));
+  if constexpr (!kCaseSensitive)
+    hs = simd::toLower(hs);
+  auto nd = _mm_set1_epi8(fold<kCaseSensitive>(*ndIt));
+  uint32_t valid = validMask(); // Positions in the chunk that can still be matched
 
   for (;;) {
     uint32_t mask = _mm_movemask_epi8(_mm_cmpeq_epi8(hs, nd));
-    mask &= uint32_t { 0xFFFF } << pos; // Mask out past positions
+    mask &= valid;
 
     if (mask != 0) { // Found a character
       if (++ndIt == ndEnd) // No characters left in the needle...
         return true; // ...success
-      nd = _mm_set1_epi8(static_cast<char>(toLower(*ndIt))); // Load the next needle character
+      nd = _mm_set1_epi8(fold<kCaseSensitive>(*ndIt)); // Load the next needle character
 
-      // We *know* there is a bit here somewhere, find its position
-      pos = ffs32(mask) & (kAlign - 1); // Last (16th) position masked out
-      if (pos != 0) // It wasn't the last character in this chunk...
+      valid &= ~(mask ^ (mask - 1)); // Mask out the found position and everything before it
+      if (valid != 0) // Something is left in this chunk...
         continue; // ...try matching this chunk again...
       // ...otherwise load the next 16 bytes from the haystack
     }
 
-    hsIt += kAlign;
-    if (hsIt == hsEnd) // Nothing left in the haystack, characters still left in the needle...
+    hsIt += kWidth;
+    if (hsIt >= hsEnd) // Nothing left in the haystack, characters still left in the needle...
       return false; // ...no match
-    hs = simd::toLower(_mm_load_si128(reinterpret_cast<const __m128i*>(hsIt))); // Next 16 bytes
-    pos = 0; // Reset current position in the chunk
+    hs = _mm_loadu_si128(reinterpret_cast<const __m128i*>(hsIt)); // Next 16 bytes
+    if constexpr (!kCaseSensitive)
+      hs = simd::toLower(hs);
+    valid = validMask();
   }
 }
 #endif
 
-} // namespace
+#if defined(FZX_AVX2)
+template <bool kCaseSensitive>
+TARGET("avx2") bool matchFuzzyAVX2(const AlignedString& needle,
+                                    std::string_view haystack) noexcept
+{
+  constexpr auto kWidth = 32;
 
-bool matchFuzzy(const AlignedString& needle, std::string_view haystack) noexcept
+  const char* ndIt = needle.data();
+  const char* const ndEnd = ndIt + needle.size();
+  if (ndIt == ndEnd)
+    return true;
+
+  const char* hsIt = haystack.data();
+  const char* const hsEnd = hsIt + haystack.size();
+  if (hsIt == hsEnd)
+    return false;
+
+  // Mask of positions in the current chunk that are a part of the haystack
+  auto validMask = [&]() -> uint32_t {
+    const auto left = hsEnd - hsIt;
+    return left >= kWidth ? ~uint32_t { 0 } : (uint32_t { 1 } << left) - 1;
+  };
+
+  // Initial state of registers
+  auto hs = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(hsIt));
+  if constexpr (!kCaseSensitive)
+    hs = simd::toLower(hs);
+  auto nd = _mm256_set1_epi8(fold<kCaseSensitive>(*ndIt));
+  uint32_t valid = validMask(); // Positions in the chunk that can still be matched
+
+  for (;;) {
+    uint32_t mask = _mm256_movemask_epi8(_mm256_cmpeq_epi8(hs, nd));
+    mask &= valid;
+
+    if (mask != 0) { // Found a character
+      if (++ndIt == ndEnd) // No characters left in the needle...
+        return true; // ...success
+      nd = _mm256_set1_epi8(fold<kCaseSensitive>(*ndIt)); // Load the next needle character
+
+      valid &= ~(mask ^ (mask - 1)); // Mask out the found position and everything before it
+      if (valid != 0) // Something is left in this chunk...
+        continue; // ...try matching this chunk again...
+      // ...otherwise load the next 32 bytes from the haystack
+    }
+
+    hsIt += kWidth;
+    if (hsIt >= hsEnd) // Nothing left in the haystack, characters still left in the needle...
+      return false; // ...no match
+    hs = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(hsIt));
+    if constexpr (!kCaseSensitive)
+      hs = simd::toLower(hs);
+    valid = validMask();
+  }
+}
+#endif
+
+#if defined(FZX_AVX512)
+template <bool kCaseSensitive>
+TARGET("avx512f,avx512bw") bool matchFuzzyAVX512(const AlignedString& needle,
+                                                  std::string_view haystack) noexcept
+{
+  constexpr auto kWidth = 64;
+
+  const char* ndIt = needle.data();
+  const char* const ndEnd = ndIt + needle.size();
+  if (ndIt == ndEnd)
+    return true;
+
+  const char* hsIt = haystack.data();
+  const char* const hsEnd = hsIt + haystack.size();
+  if (hsIt == hsEnd)
+    return false;
+
+  // Mask of positions in the current chunk that are a part of the haystack
+  auto validMask = [&]() -> __mmask64 {
+    const auto left = hsEnd - hsIt;
+    return left >= kWidth ? ~uint64_t { 0 } : (uint64_t { 1 } << left) - 1;
+  };
+
+  // Masked loads don't touch the memory past the haystack at all
+  uint64_t valid = validMask(); // Positions in the chunk that can still be matched
+  auto hs = _mm512_maskz_loadu_epi8(valid, hsIt);
+  if constexpr (!kCaseSensitive)
+    hs = simd::toLower(hs);
+  auto nd = _mm512_set1_epi8(fold<kCaseSensitive>(*ndIt));
+
+  for (;;) {
+    uint64_t mask = _mm512_mask_cmpeq_epi8_mask(valid, hs, nd);
+
+    if (mask != 0) { // Found a character
+      if (++ndIt == ndEnd) // No characters left in the needle...
+        return true; // ...success
+      nd = _mm512_set1_epi8(fold<kCaseSensitive>(*ndIt)); // Load the next needle character
+
+      valid &= ~(mask ^ (mask - 1)); // Mask out the found position and everything before it
+      if (valid != 0) // Something is left in this chunk...
+        continue; // ...try matching this chunk again...
+      // ...otherwise load the next 64 bytes from the haystack
+    }
+
+    hsIt += kWidth;
+    if (hsIt >= hsEnd) // Nothing left in the haystack, characters still left in the needle...
+      return false; // ...no match
+    valid = validMask();
+    hs = _mm512_maskz_loadu_epi8(valid, hsIt);
+    if constexpr (!kCaseSensitive)
+      hs = simd::toLower(hs);
+  }
+}
+#endif
+
+using MatchFn = bool (*)(const AlignedString& needle, std::string_view haystack) noexcept;
+
+/// matchFuzzy kernels for haystacks up to 16 bytes, up to 32 bytes and longer ones.
+struct FuzzyKernels
+{
+  MatchFn mShort;
+  MatchFn mMedium;
+  MatchFn mLong;
+};
+
+template <bool kCaseSensitive>
+FuzzyKernels selectFuzzyKernels() noexcept
 {
 #if defined(FZX_SSE2)
-  return matchFuzzySSE(needle, haystack);
+  constexpr auto sse = matchFuzzySSE<kCaseSensitive>;
+  FuzzyKernels r { sse, sse, sse };
 #else
-  return matchFuzzyNaive(needle, haystack);
+  constexpr auto naive = matchFuzzyNaive<kCaseSensitive>;
+  FuzzyKernels r { naive, naive, naive };
+#endif
+  // Pick the narrowest kernel that covers the haystack in one load. Wider loads don't help
+  // short items, and the wide kernels have to mask out what's past the haystack.
+#if defined(FZX_AVX2)
+  if (cpuSupports(kCpuAVX2))
+    r.mMedium = r.mLong = matchFuzzyAVX2<kCaseSensitive>;
+#endif
+#if defined(FZX_AVX512)
+  if (cpuSupports(kCpuAVX512))
+    r.mLong = matchFuzzyAVX512<kCaseSensitive>;
 #endif
+  return r;
 }
 
-bool matchBegin(const AlignedString& needle, std::string_view haystack) noexcept
+// Selected once, when the library is loaded. Indexed by case sensitivity.
+const FuzzyKernels kFuzzyKernels[2] { selectFuzzyKernels<false>(), selectFuzzyKernels<true>() };
+
+#if defined(FZX_SSE2)
+/// Comparison of `len` bytes. Whole 16 byte chunks are loaded from both strings.
+template <bool kCaseSensitive>
+INLINE bool equalSSE(const char* a, const char* b, size_t len) noexcept
 {
-  if (needle.size() > haystack.size())
-    return false;
-  const char* n = needle.data();
-  const char* nend = n + needle.size();
-  const char* h = haystack.data();
-  while (n != nend) {
-    if (toLower(*n) != toLower(*h))
+  for (size_t i = 0; i < len; i += 16) {
+    auto x = _mm_loadu_si128(reinterpret_cast<const __m128i*>(a + i));
+    auto y = _mm_loadu_si128(reinterpret_cast<const __m128i*>(b + i));
+    if constexpr (!kCaseSensitive) {
+      x = simd::toLower(x);
+      y = simd::toLower(y);
+    }
+    uint32_t mask = ~_mm_movemask_epi8(_mm_cmpeq_epi8(x, y)) & 0xFFFF;
+    if (len - i < 16)
+      mask &= (uint32_t { 1 } << (len - i)) - 1; // Mask out what's past the end
+    if (mask != 0)
       return false;
-    ++n;
-    ++h;
   }
   return true;
 }
+#endif
+
+template <bool kCaseSensitive>
+[[maybe_unused]] bool equalNaive(const char* a, const char* b, size_t len) noexcept
+{
+  for (size_t i = 0; i < len; ++i)
+    if (fold<kCaseSensitive>(a[i]) != fold<kCaseSensitive>(b[i]))
+      return false;
+  return true;
+}
+
+template <bool kCaseSensitive>
+INLINE bool equal(const char* a, const char* b, size_t len) noexcept
+{
+#if defined(FZX_SSE2)
+  return equalSSE<kCaseSensitive>(a, b, len);
+#else
+  return equalNaive<kCaseSensitive>(a, b, len);
+#endif
+}
+
+// Substring search kernels. Both the needle and the haystack are non-empty and the needle is not
+// longer than the haystack.
+
+template <bool kCaseSensitive>
+[[maybe_unused]] int matchSubstrNaive(const AlignedString& needle,
+                                      std::string_view haystack) noexcept
+{
+  const size_t count = haystack.size() - needle.size() + 1; // Number of possible starts
+  for (size_t i = 0; i < count; ++i)
+    if (equalNaive<kCaseSensitive>(needle.data(), haystack.data() + i, needle.size()))
+      return static_cast<int>(i);
+  return -1;
+}
+
+// Vectorized version of the usual strstr. Positions where both the first and the last character
+// of the needle match are found for a whole chunk at once, only those are compared in full.
+
+#if defined(FZX_SSE2)
+template <bool kCaseSensitive>
+[[maybe_unused]] int matchSubstrSSE(const AlignedString& needle, std::string_view haystack) noexcept
+{
+  constexpr size_t kWidth = 16;
+
+  const size_t size = needle.size();
+  const size_t count = haystack.size() - size + 1; // Number of possible starts
+  const char* const hs = haystack.data();
+  const auto first = _mm_set1_epi8(fold<kCaseSensitive>(needle[0]));
+  const auto last = _mm_set1_epi8(fold<kCaseSensitive>(needle[size - 1]));
+
+  for (size_t i = 0; i < count; i += kWidth) {
+    auto a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(hs + i));
+    auto b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(hs + i + size - 1));
+    if constexpr (!kCaseSensitive) {
+      a = simd::toLower(a);
+      b = simd::toLower(b);
+    }
+    uint32_t mask = _mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(a, first),
+                                                    _mm_cmpeq_epi8(b, last)));
+    if (count - i < kWidth)
+      mask &= (uint32_t { 1 } << (count - i)) - 1; // Mask out starts past the end
+    for (; mask != 0; mask &= mask - 1) {
+      const size_t pos = i + ffs32(mask) - 1;
+      if (size <= 2 || equalSSE<kCaseSensitive>(needle.data(), hs + pos, size))
+        return static_cast<int>(pos);
+    }
+  }
+  return -1;
+}
+#endif
+
+#if defined(FZX_AVX2)
+template <bool kCaseSensitive>
+TARGET("avx2") int matchSubstrAVX2(const AlignedString& needle, std::string_view haystack) noexcept
+{
+  constexpr size_t kWidth = 32;
+
+  const size_t size = needle.size();
+  const size_t count = haystack.size() - size + 1; // Number of possible starts
+  const char* const hs = haystack.data();
+  const auto first = _mm256_set1_epi8(fold<kCaseSensitive>(needle[0]));
+  const auto last = _mm256_set1_epi8(fold<kCaseSensitive>(needle[size - 1]));
+
+  for (size_t i = 0; i < count; i += kWidth) {
+    auto a = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(hs + i));
+    auto b = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(hs + i + size - 1));
+    if constexpr (!kCaseSensitive) {
+      a = simd::toLower(a);
+      b = simd::toLower(b);
+    }
+    uint32_t mask = _mm256_movemask_epi8(_mm256_and_si256(_mm256_cmpeq_epi8(a, first),
+                                                          _mm256_cmpeq_epi8(b, last)));
+    if (count - i < kWidth)
+      mask &= (uint32_t { 1 } << (count - i)) - 1; // Mask out starts past the end
+    for (; mask != 0; mask &= mask - 1) {
+      const size_t pos = i + ffs32(mask) - 1;
+      if (size <= 2 || equalSSE<kCaseSensitive>(needle.data(), hs + pos, size))
+        return static_cast<int>(pos);
+    }
+  }
+  return -1;
+}
+#endif
+
+using MatchIndexFn = int (*)(const AlignedString& needle, std::string_view haystack) noexcept;
+
+/// matchSubstrIndex kernels for haystacks up to 32 bytes and longer ones.
+struct SubstrKernels
+{
+  MatchIndexFn mShort;
+  MatchIndexFn mLong;
+};
+
+template <bool kCaseSensitive>
+SubstrKernels selectSubstrKernels() noexcept
+{
+#if defined(FZX_SSE2)
+  SubstrKernels r { matchSubstrSSE<kCaseSensitive>, matchSubstrSSE<kCaseSensitive> };
+#else
+  SubstrKernels r { matchSubstrNaive<kCaseSensitive>, matchSubstrNaive<kCaseSensitive> };
+#endif
+#if defined(FZX_AVX2)
+  if (cpuSupports(kCpuAVX2))
+    r.mLong = matchSubstrAVX2<kCaseSensitive>;
+#endif
+  return r;
+}
+
+// Selected once, when the library is loaded. Indexed by case sensitivity.
+const SubstrKernels kSubstrKernels[2] { selectSubstrKernels<false>(), selectSubstrKernels<true>() };
+
+} // namespace
+
+template <bool kCaseSensitive>
+bool matchFuzzy(const AlignedString& needle, std::string_view haystack) noexcept
+{
+  const FuzzyKernels& kernels = kFuzzyKernels[kCaseSensitive];
+  if (haystack.size() > 32)
+    return kernels.mLong(needle, haystack);
+  if (haystack.size() > 16)
+    return kernels.mMedium(needle, haystack);
+  return kernels.mShort(needle, haystack);
+}
+
+template <bool kCaseSensitive>
+bool matchBegin(const AlignedString& needle, std::string_view haystack) noexcept
+{
+  if (needle.size() > haystack.size())
+    return false;
+  return equal<kCaseSensitive>(needle.data(), haystack.data(), needle.size());
+}
 
+template <bool kCaseSensitive>
 bool matchEnd(const AlignedString& needle, std::string_view haystack) noexcept
 {
   if (needle.size() > haystack.size())
     return false;
-  const char* n = needle.data();
-  const char* nend = n + needle.size();
   const char* h = haystack.data() + haystack.size() - needle.size();
-  while (n != nend) {
-    if (toLower(*n) != toLower(*h))
-      return false;
-    ++n;
-    ++h;
-  }
-  return true;
+  return equal<kCaseSensitive>(needle.data(), h, needle.size());
 }
 
+template <bool kCaseSensitive>
 bool matchExact(const AlignedString& needle, std::string_view haystack) noexcept
 {
   if (needle.size() != haystack.size())
     return false;
-  const char* n = needle.data();
-  const char* nend = n + needle.size();
-  const char* h = haystack.data();
-  while (n != nend) {
-    if (toLower(*n) != toLower(*h))
-      return false;
-    ++n;
-    ++h;
-  }
-  return true;
+  return equal<kCaseSensitive>(needle.data(), haystack.data(), needle.size());
 }
 
+template <bool kCaseSensitive>
 bool matchSubstr(const AlignedString& needle, std::string_view haystack) noexcept
 {
-  if (needle.empty())
-    return true;
-  if (needle.size() > haystack.size())
-    return false;
-
-  const char* n = needle.data();
-  const char* nend = n + needle.size();
-  const char* h = haystack.data();
-  const char* hend = h + haystack.size() - needle.size() + 1;
-
-  while (h != hend) {
-    auto cmp = [&]() -> bool {
-      for (const char *np = n, *hp = h; np != nend; ++np, ++hp)
-        if (toLower(*np) != toLower(*hp))
-          return false;
-      return true;
-    };
-
-    if (cmp())
-      return true;
-    ++h;
-  }
-
-  return false;
+  return matchSubstrIndex<kCaseSensitive>(needle, haystack) >= 0;
 }
 
+template <bool kCaseSensitive>
 int matchSubstrIndex(const AlignedString& needle, std::string_view haystack) noexcept
 {
   if (needle.empty())
     return 0;
   if (needle.size() > haystack.size())
     return -1;
-
-  const int nEnd = static_cast<int>(needle.size());
-  const int hEnd = static_cast<int>(haystack.size() - needle.size()) + 1;
-
-  for (int i = 0; i != hEnd; ++i) {
-    auto cmp = [&]() -> bool {
-      for (int n = 0, h = i; n != nEnd; ++n, ++h)
-        if (toLower(needle[n]) != toLower(haystack[h]))
-          return false;
-      return true;
-    };
-
-    if (cmp())
-      return i;
-  }
-
-  return -1;
+  const SubstrKernels& kernels = kSubstrKernels[kCaseSensitive];
+  if (haystack.size() > 32)
+    return kernels.mLong(needle, haystack);
+  return kernels.mShort(needle, haystack);
 }
 
+template bool matchFuzzy<false>(const AlignedString& needle,
+                                std::string_view haystack) noexcept;
+template bool matchBegin<false>(const AlignedString& needle,
+                                std::string_view haystack) noexcept;
+template bool matchEnd<false>(const AlignedString& needle,
+                              std::string_view haystack) noexcept;
+template bool matchExact<false>(const AlignedString& needle,
+                                std::string_view haystack) noexcept;
+template bool matchSubstr<false>(const AlignedString& needle,
+                                 std::string_view haystack) noexcept;
+template int matchSubstrIndex<false>(const AlignedString& needle,
+                                     std::string_view haystack) noexcept;
+template bool matchFuzzy<true>(const AlignedString& needle,
+                               std::string_view haystack) noexcept;
+template bool matchBegin<true>(const AlignedString& needle,
+                               std::string_view haystack) noexcept;
+template bool matchEnd<true>(const AlignedString& needle,
+                             std::string_view haystack) noexcept;
+template bool matchExact<true>(const AlignedString& needle,
+                               std::string_view haystack) noexcept;
+template bool matchSubstr<true>(const AlignedString& needle,
+                                std::string_view haystack) noexcept;
+template int matchSubstrIndex<true>(const AlignedString& needle,
+                                    std::string_view haystack) noexcept;
+
 } // namespace fzx
@@ -8,16 +8,53 @@
 
 namespace fzx {
 
-/// Precondition: haystack is aligned to 16 bytes and is padded to 16 bytes with zeros
+// Matchers are case insensitive by default. The case sensitive versions compare bytes as they
+// are, which also skips folding the case of every loaded chunk.
+
+/// Precondition: at least 64 bytes past the haystack have to be readable, see kOveralloc.
+template <bool kCaseSensitive = false>
 bool matchFuzzy(const AlignedString& needle, std::string_view haystack) noexcept;
 
+// The rest load whole chunks, so at least 32 bytes past the haystack have to be readable. Items
+// in fzx::Items satisfy that, see kOveralloc.
+
+template <bool kCaseSensitive = false>
 bool matchBegin(const AlignedString& needle, std::string_view haystack) noexcept;
 
+template <bool kCaseSensitive = false>
 bool matchEnd(const AlignedString& needle, std::string_view haystack) noexcept;
 
+template <bool kCaseSensitive = false>
 bool matchExact(const AlignedString& needle, std::string_view haystack) noexcept;
 
+template <bool kCaseSensitive = false>
 bool matchSubstr(const AlignedString& needle, std::string_view haystack) noexcept;
+template <bool kCaseSensitive = false>
 int matchSubstrIndex(const AlignedString& needle, std::string_view haystack) noexcept;
 
+extern template bool matchFuzzy<false>(const AlignedString& needle,
+                                       std::string_view haystack) noexcept;
+extern template bool matchFuzzy<true>(const AlignedString& needle,
+                                      std::string_view haystack) noexcept;
+extern template bool matchBegin<false>(const AlignedString& needle,
+                                       std::string_view haystack) noexcept;
+extern template bool matchBegin<true>(const AlignedString& needle,
+                                      std::string_view haystack) noexcept;
+extern template bool matchEnd<false>(const AlignedString& needle,
+                                     std::string_view haystack) noexcept;
+extern template bool matchEnd<true>(const AlignedString& needle,
+                                    std::string_view haystack) noexcept;
+extern template bool matchExact<false>(const AlignedString& needle,
+                                       std::string_view haystack) noexcept;
+extern template bool matchExact<true>(const AlignedString& needle,
+                                      std::string_view haystack) noexcept;
+extern template bool matchSubstr<false>(const AlignedString& needle,
+                                        std::string_view haystack) noexcept;
+extern template bool matchSubstr<true>(const AlignedString& needle,
+                                       std::string_view haystack) noexcept;
+extern template int matchSubstrIndex<false>(const AlignedString& needle,
+                                            std::string_view haystack) noexcept;
+extern template int matchSubstrIndex<true>(const AlignedString& needle,
+                                           std::string_view haystack) noexcept;
+
 } // namespace fzx
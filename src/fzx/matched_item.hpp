@@ -2,6 +2,7 @@
 
 #pragma once
 
+#include <algorithm>
 #include <cmath>
 #include <cstdint>
 #include <limits>
@@ -23,24 +24,29 @@ class MatchedItem
   static constexpr auto kMin = std::numeric_limits<int32_t>::min();
   static constexpr auto kMax = std::numeric_limits<int32_t>::max();
   static constexpr auto kInf = std::numeric_limits<float>::infinity();
+  /// Largest float below 2^31, kMin and kMax are reserved for infinite scores.
+  static constexpr float kLimit = 2147483520.F;
 
 public:
   MatchedItem() noexcept = default;
 
   [[nodiscard]] int64_t value() const { return mValue; }
 
+  /// Unsigned key with the same order as the items, for radix sorting and searching by key.
+  [[nodiscard]] uint64_t key() const noexcept
+  {
+    return static_cast<uint64_t>(mValue) ^ (uint64_t { 1 } << 63);
+  }
+
   MatchedItem(uint32_t index, float score) noexcept
   {
     int32_t hi; // NOLINT(cppcoreguidelines-init-variables)
     if (!std::isinf(score)) {
       DEBUG_ASSERT(!std::isnan(score));
-      // No loss of precision.
-      //
-      // Right now there is a limit on the haystack length, and the max possible
-      // score is 1024 * 200 = 204800. With the current scoring the limit could
-      // be raised to UINT16_MAX just fine. If necessary, it of course could be
-      // extended to the full range of int32 in the future.
-      DEBUG_ASSERT(score >= -16777216.F && score <= 16777216.F);
+      // No loss of precision for scores within [-16777216, 16777216], see score.hpp. Scores of
+      // haystacks long enough to go past that are still ordered, but they are rounded, and are
+      // clamped to what fits in the high 32 bits.
+      score = std::clamp(score, -kLimit, kLimit);
       // Negate the score value, to prefer higher scores in the less-than operator.
       hi = -static_cast<int32_t>(score);
     } else {
@@ -0,0 +1,160 @@
+// Licensed under LGPLv3 - see LICENSE file for details.
+
+#include "fzx/numa.hpp"
+
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#if defined(__linux__)
+extern "C" {
+# include <linux/mempolicy.h>
+# include <pthread.h>
+# include <sched.h>
+# include <sys/syscall.h>
+# include <unistd.h>
+}
+#endif
+
+namespace fzx {
+
+#if defined(__linux__)
+
+namespace {
+
+/// Node ids are limited to a single word of the mbind node mask.
+constexpr size_t kMaxNodeId = 64;
+
+struct Topology
+{
+  /// Ids of the online nodes.
+  std::vector<unsigned> mNodes;
+  /// CPUs of each node.
+  std::vector<std::vector<unsigned>> mCpus;
+};
+
+/// Read a single line from a sysfs file.
+std::string readLine(const std::string& path)
+{
+  std::string r;
+  std::FILE* file = std::fopen(path.c_str(), "r");
+  if (file == nullptr)
+    return r;
+  for (int ch = std::fgetc(file); ch != EOF && ch != '\n'; ch = std::fgetc(file))
+    r.push_back(static_cast<char>(ch));
+  std::fclose(file);
+  return r;
+}
+
+/// Parse a sysfs list, like "0-3,8-11".
+std::vector<unsigned> parseList(const std::string& s)
+{
+  std::vector<unsigned> r;
+  unsigned first = 0;
+  unsigned value = 0;
+  bool range = false;
+  for (size_t i = 0; i <= s.size(); ++i) {
+    const char ch = i < s.size() ? s[i] : ',';
+    if (ch >= '0' && ch <= '9') {
+      value = value * 10 + static_cast<unsigned>(ch - '0');
+    } else if (ch == '-') {
+      first = value;
+      value = 0;
+      range = true;
+    } else if (ch == ',') {
+      if (i > 0)
+        for (unsigned v = range ? first : value; v <= value; ++v)
+          r.push_back(v);
+      value = 0;
+      range = false;
+    } else {
+      return {};
+    }
+  }
+  return r;
+}
+
+Topology detectTopology()
+{
+  Topology r;
+  for (unsigned node : parseList(readLine("/sys/devices/system/node/online"))) {
+    auto cpus =
+        parseList(readLine("/sys/devices/system/node/node" + std::to_string(node) + "/cpulist"));
+    // Nodes with memory only, their memory is used through the other nodes.
+    if (cpus.empty() || node >= kMaxNodeId)
+      continue;
+    r.mNodes.push_back(node);
+    r.mCpus.push_back(std::move(cpus));
+  }
+  return r;
+}
+
+const Topology& topology()
+{
+  static const Topology kTopology = detectTopology();
+  return kTopology;
+}
+
+} // namespace
+
+size_t numaNodes() noexcept
+try {
+  const size_t nodes = topology().mNodes.size();
+  return nodes != 0 ? nodes : 1;
+} catch (...) {
+  return 1;
+}
+
+bool pinThread(size_t node) noexcept
+try {
+  const Topology& t = topology();
+  if (node >= t.mNodes.size())
+    return false;
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  for (unsigned cpu : t.mCpus[node])
+    if (cpu < CPU_SETSIZE)
+      CPU_SET(cpu, &set);
+  return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+} catch (...) {
+  return false;
+}
+
+bool bindMemory(const void* p, size_t size, size_t node) noexcept
+try {
+  const Topology& t = topology();
+  if (node >= t.mNodes.size() || size == 0)
+    return false;
+  static const auto kPageSize = static_cast<uintptr_t>(sysconf(_SC_PAGESIZE));
+  const auto begin = reinterpret_cast<uintptr_t>(p) / kPageSize * kPageSize;
+  const auto end = (reinterpret_cast<uintptr_t>(p) + size + kPageSize - 1) / kPageSize * kPageSize;
+  const unsigned long mask = 1UL << t.mNodes[node];
+  // Preferred rather than bound, so running out of memory on the node isn't fatal.
+  return syscall(SYS_mbind, begin, end - begin, MPOL_PREFERRED, &mask, kMaxNodeId + 1,
+                 MPOL_MF_MOVE)
+      == 0;
+} catch (...) {
+  return false;
+}
+
+#else
+
+size_t numaNodes() noexcept
+{
+  return 1;
+}
+
+bool pinThread(size_t) noexcept
+{
+  return false;
+}
+
+bool bindMemory(const void*, size_t, size_t) noexcept
+{
+  return false;
+}
+
+#endif
+
+} // namespace fzx
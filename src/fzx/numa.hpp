@@ -0,0 +1,28 @@
+// Licensed under LGPLv3 - see LICENSE file for details.
+
+#pragma once
+
+#include <cstddef>
+
+namespace fzx {
+
+/// Get the number of NUMA nodes. Detected once, on the first call. Always 1 on platforms other
+/// than Linux.
+[[nodiscard]] size_t numaNodes() noexcept;
+
+/// Get the node of worker `worker` out of `workers`, spread across `nodes` nodes. Workers are
+/// split into contiguous blocks, so the ones merging each other's results mostly share a node.
+[[nodiscard]] constexpr size_t numaNode(size_t worker, size_t workers, size_t nodes) noexcept
+{
+  return workers == 0 ? 0 : worker * nodes / workers;
+}
+
+/// Pin the calling thread to the CPUs of `node`. Returns false if it's not supported.
+bool pinThread(size_t node) noexcept;
+
+/// Prefer `node` for the memory pages of `[p, p + size)`, including the ones only partially in
+/// it. Pages allocated already are moved there. Best-effort, returns false if it's not
+/// supported.
+bool bindMemory(const void* p, size_t size, size_t node) noexcept;
+
+} // namespace fzx
@@ -1,15 +1,302 @@
 #include "fzx/query.hpp"
 
+#include <algorithm>
+#include <string>
+
 #include "fzx/macros.hpp"
+#include "fzx/strings.hpp"
 
 namespace fzx {
 
-Query Query::parse(std::string_view s)
+namespace {
+
+char foldFor(char ch) noexcept
 {
-  if (s.empty())
-    return {};
+  return static_cast<char>(toLower(ch));
+}
+
+char32_t foldFor(char32_t ch) noexcept
+{
+  return foldCase(ch);
+}
+
+template <typename Char>
+bool equalsFold(std::basic_string_view<Char> a,
+                std::basic_string_view<Char> b,
+                bool caseSensitive) noexcept
+{
+  if (caseSensitive)
+    return a == b;
+  if (a.size() != b.size())
+    return false;
+  for (size_t i = 0; i < a.size(); ++i)
+    if (foldFor(a[i]) != foldFor(b[i]))
+      return false;
+  return true;
+}
+
+/// Check if `needle` is a subsequence of `s`.
+template <typename Char>
+bool containsFuzzy(std::basic_string_view<Char> s,
+                   std::basic_string_view<Char> needle,
+                   bool caseSensitive) noexcept
+{
+  auto it = s.begin();
+  for (Char ch : needle) {
+    if (caseSensitive) {
+      while (it != s.end() && *it != ch)
+        ++it;
+    } else {
+      while (it != s.end() && foldFor(*it) != foldFor(ch))
+        ++it;
+    }
+    if (it == s.end())
+      return false;
+    ++it;
+  }
+  return true;
+}
+
+/// Check if `needle` is a substring of `s`.
+template <typename Char>
+bool containsSubstr(std::basic_string_view<Char> s,
+                    std::basic_string_view<Char> needle,
+                    bool caseSensitive) noexcept
+{
+  if (needle.size() > s.size())
+    return false;
+  for (size_t i = 0; i + needle.size() <= s.size(); ++i)
+    if (equalsFold(s.substr(i, needle.size()), needle, caseSensitive))
+      return true;
+  return false;
+}
+
+/// Check if every string matched by a term of type `a` with text `at` is also matched by a term
+/// of type `b` with text `bt`.
+template <typename Char>
+bool impliesText(MatchType a,
+                 std::basic_string_view<Char> at,
+                 MatchType b,
+                 std::basic_string_view<Char> bt,
+                 bool cs) noexcept
+{
+  switch (b) {
+  case MatchType::kFuzzy:
+    // Every match type guarantees that its text is a subsequence of the haystack.
+    return containsFuzzy(at, bt, cs);
+  case MatchType::kSubstr:
+    return a != MatchType::kFuzzy && containsSubstr(at, bt, cs);
+  case MatchType::kBegin:
+    return (a == MatchType::kBegin || a == MatchType::kExact) && at.size() >= bt.size()
+        && equalsFold(at.substr(0, bt.size()), bt, cs);
+  case MatchType::kEnd:
+    return (a == MatchType::kEnd || a == MatchType::kExact) && at.size() >= bt.size()
+        && equalsFold(at.substr(at.size() - bt.size()), bt, cs);
+  case MatchType::kExact:
+    return a == MatchType::kExact && equalsFold(at, bt, cs);
+  }
+  return false;
+}
+
+/// Check if every string matched by `a` is also matched by `b`.
+bool implies(const Query::Item& a, const Query::Item& b) noexcept
+{
+  // Negated terms would need the reverse relation. They are rare enough
+  // that it's not worth the trouble, just require them to be the same.
+  if (a.mNot || b.mNot)
+    return a == b;
+  // Case sensitive match is also a case insensitive one, but not the other way around.
+  if (b.mCaseSensitive && !a.mCaseSensitive)
+    return false;
+
+  const bool cs = b.mCaseSensitive;
+  if (a.mAscii && b.mAscii)
+    return impliesText<char>(a.mType, a.mText, b.mType, b.mText, cs);
+
+  // Terms with non-ASCII characters match by code points, see matchUnicode, so they are compared
+  // decoded. Case folding never turns a non-ASCII character into an ASCII one, so an ASCII term
+  // compares the same way decoded.
+  std::u32string folded;
+  std::u32string_view at = a.mChars;
+  if (!cs && a.mCaseSensitive) {
+    folded = a.mChars;
+    for (auto& ch : folded)
+      ch = foldCase(ch);
+    at = folded;
+  }
+  return impliesText<char32_t>(a.mType, at, b.mType, b.mChars, cs);
+}
+
+using ScoreFn = Score (*)(const AlignedString& needle, std::string_view haystack) noexcept;
+
+/// Pick the scoring kernel for a needle of `size` characters.
+template <bool kCaseSensitive>
+ScoreFn pickScoreFn(size_t size) noexcept
+{
+  switch (size) {
+  default:
+#if defined(FZX_SSE2)
+    return fzx::scoreSSELong<kCaseSensitive>;
+#else
+    return fzx::score<kCaseSensitive>;
+#endif
+  case 1:
+    return fzx::score1<kCaseSensitive>;
+#if defined(FZX_SSE2)
+  case 2:
+  case 3:
+  case 4:
+    return fzx::scoreSSE<4, kCaseSensitive>;
+  case 5:
+  case 6:
+  case 7:
+  case 8:
+    return fzx::scoreSSE<8, kCaseSensitive>;
+  case 9:
+  case 10:
+  case 11:
+  case 12:
+    return fzx::scoreSSE<12, kCaseSensitive>;
+  case 13:
+  case 14:
+  case 15:
+  case 16:
+    return fzx::scoreSSE<16, kCaseSensitive>;
+#elif defined(FZX_NEON)
+  case 2:
+  case 3:
+  case 4:
+    return fzx::scoreNeon<4, kCaseSensitive>;
+  case 5:
+  case 6:
+  case 7:
+  case 8:
+    return fzx::scoreNeon<8, kCaseSensitive>;
+  case 9:
+  case 10:
+  case 11:
+  case 12:
+    return fzx::scoreNeon<12, kCaseSensitive>;
+  case 13:
+  case 14:
+  case 15:
+  case 16:
+    return fzx::scoreNeon<16, kCaseSensitive>;
+#endif
+  }
+}
+
+using ScoreBatchFn = void (*)(const AlignedString& needle,
+                              const std::string_view* haystacks,
+                              Score* scores) noexcept;
+
+/// Pick the kernel scoring kScoreBatch strings at once for a needle of `size` characters, if there
+/// is one. Short needles are scored for multiple items at once.
+template <bool kCaseSensitive>
+ScoreBatchFn pickScoreBatchFn([[maybe_unused]] size_t size) noexcept
+{
+#if defined(FZX_SSE2)
+  switch (size) {
+  case 1:
+    return fzx::scoreBatchSSE<1, kCaseSensitive>;
+  case 2:
+    return fzx::scoreBatchSSE<2, kCaseSensitive>;
+  case 3:
+    return fzx::scoreBatchSSE<3, kCaseSensitive>;
+  default:
+    break;
+  }
+#endif
+  return nullptr;
+}
+
+using MatchFn = bool (*)(const AlignedString& needle, std::string_view haystack) noexcept;
+
+template <bool kCaseSensitive>
+MatchFn pickMatchFn(MatchType type) noexcept
+{
+  switch (type) {
+  case MatchType::kFuzzy:
+    return matchFuzzy<kCaseSensitive>;
+  case MatchType::kSubstr:
+    return matchSubstr<kCaseSensitive>;
+  case MatchType::kBegin:
+    return matchBegin<kCaseSensitive>;
+  case MatchType::kEnd:
+    return matchEnd<kCaseSensitive>;
+  case MatchType::kExact:
+    return matchExact<kCaseSensitive>;
+  }
+  return nullptr;
+}
+
+/// Rough cost of matching a term. Cheap terms that are likely to reject a string go first.
+int matchCost(const Query::Item& item) noexcept
+{
+  int cost = 0;
+  switch (item.mType) {
+  case MatchType::kExact:
+    cost = 0; // Rejects almost everything by the size alone
+    break;
+  case MatchType::kBegin:
+    cost = 1;
+    break;
+  case MatchType::kEnd:
+    cost = 2;
+    break;
+  case MatchType::kSubstr:
+    cost = 3;
+    break;
+  case MatchType::kFuzzy:
+    cost = 4;
+    break;
+  }
+  // Terms with non-ASCII characters have to decode the string first
+  return item.mAscii ? cost : cost + 5;
+}
+
+/// Match a term in a decoded string, see fzx::decodeUtf8. Returns the index of the first
+/// matched character, or -1 if there's no match.
+int matchUnicode(const Query::Item& item, std::u32string_view s) noexcept
+{
+  const std::u32string_view n = item.mChars;
+  const bool cs = item.mCaseSensitive;
+  auto eq = [cs](char32_t a, char32_t b) { return (cs ? a : foldCase(a)) == b; };
+
+  switch (item.mType) {
+  case MatchType::kFuzzy: {
+    size_t j = 0;
+    for (size_t i = 0; i < s.size() && j < n.size(); ++i)
+      if (eq(s[i], n[j]))
+        ++j;
+    return j == n.size() ? 0 : -1;
+  }
+  case MatchType::kSubstr: {
+    auto it = std::search(s.begin(), s.end(), n.begin(), n.end(), eq);
+    return it == s.end() && !n.empty() ? -1 : static_cast<int>(it - s.begin());
+  }
+  case MatchType::kBegin:
+    return s.size() >= n.size() && std::equal(s.begin(), s.begin() + n.size(), n.begin(), eq)
+        ? 0
+        : -1;
+  case MatchType::kEnd:
+    return s.size() >= n.size() && std::equal(s.end() - n.size(), s.end(), n.begin(), eq)
+        ? static_cast<int>(s.size() - n.size())
+        : -1;
+  case MatchType::kExact:
+    return s.size() == n.size() && std::equal(s.begin(), s.end(), n.begin(), eq) ? 0 : -1;
+  }
+  return -1;
+}
+
+} // namespace
 
+Query Query::parse(std::string_view s, CaseMode caseMode)
+{
   Query q;
+  q.mCaseMode = caseMode;
+  if (s.empty())
+    return q;
 
   constexpr char kSeparator = ' ';
   constexpr size_t kInvalid = -1;
@@ -61,115 +348,138 @@ Query Query::parse(std::string_view s)
   return q;
 }
 
-bool Query::match(std::string_view s) const
+bool Query::refines(const Query& prev) const
 {
-  for (const auto& item : mItems) {
-    switch (item.mType) {
-    case MatchType::kFuzzy:
-      if (!matchFuzzy(item.mText, s) ^ item.mNot)
-        return false;
-      break;
-    case MatchType::kSubstr:
-      if (!matchSubstr(item.mText, s) ^ item.mNot)
-        return false;
-      break;
-    case MatchType::kBegin:
-      if (!matchBegin(item.mText, s) ^ item.mNot)
-        return false;
-      break;
-    case MatchType::kEnd:
-      if (!matchEnd(item.mText, s) ^ item.mNot)
-        return false;
-      break;
-    case MatchType::kExact:
-      if (!matchExact(item.mText, s) ^ item.mNot)
-        return false;
-      break;
+  if (prev.empty())
+    return true;
+  for (const auto& b : prev.mItems) {
+    if (!std::any_of(mItems.begin(), mItems.end(), [&](const Item& a) { return implies(a, b); }))
+      return false;
+  }
+  return true;
+}
+
+/// Characters of a string with non-ASCII characters, decoded on first use. The buffer is reused
+/// by the thread.
+struct Query::Chars
+{
+  std::string_view mStr;
+  bool mDecoded { false };
+
+  std::u32string_view get()
+  {
+    thread_local std::u32string buffer;
+    if (!mDecoded) {
+      decodeUtf8(mStr, buffer);
+      mDecoded = true;
     }
+    return buffer;
+  }
+};
+
+void Query::compile()
+{
+  mMatchPlan.clear();
+  mScorePlan.clear();
+  for (uint32_t i = 0; i < mItems.size(); ++i) {
+    const Item& item = mItems[i];
+    MatchFn match = nullptr;
+    if (item.mAscii)
+      match = item.mCaseSensitive ? pickMatchFn<true>(item.mType) : pickMatchFn<false>(item.mType);
+    mMatchPlan.push_back({ i, match });
+
+    if (item.mType != MatchType::kFuzzy || item.mNot)
+      continue;
+    const size_t size = item.mText.size();
+    if (item.mCaseSensitive)
+      mScorePlan.push_back({ i, pickScoreFn<true>(size), pickScoreBatchFn<true>(size) });
+    else
+      mScorePlan.push_back({ i, pickScoreFn<false>(size), pickScoreBatchFn<false>(size) });
+  }
+
+  std::stable_sort(mMatchPlan.begin(), mMatchPlan.end(), [&](const auto& a, const auto& b) {
+    return matchCost(mItems[a.mItem]) < matchCost(mItems[b.mItem]);
+  });
+}
+
+bool Query::matchPlan(std::string_view s, bool ascii, Chars& chars) const
+{
+  for (const auto& step : mMatchPlan) {
+    const Item& item = mItems[step.mItem];
+    bool matched = false;
+    if (step.mMatch != nullptr) {
+      // UTF-8 never uses ASCII bytes in multi-byte characters, so the bytes can be matched
+      // even if the string isn't ASCII
+      matched = step.mMatch(item.mText, s);
+    } else if (!ascii) {
+      matched = matchUnicode(item, chars.get()) != -1;
+    } // else non-ASCII characters can't match an ASCII string
+    if (!matched ^ item.mNot)
+      return false;
   }
   return true;
 }
 
-Score Query::score(std::string_view s) const
+Score Query::scorePlan(std::string_view s, bool ascii, Chars& chars) const
 {
+  if (mScorePlan.empty())
+    return 0;
+
   Score sum = 0;
-  uint32_t div = 0;
+  for (const auto& step : mScorePlan) {
+    const Item& item = mItems[step.mItem];
+    sum += ascii ? step.mScore(item.mText, s)
+                 : scoreUnicode(item.mChars, chars.get(), item.mCaseSensitive);
+  }
+  return sum / static_cast<Score>(mScorePlan.size());
+}
 
-  for (const auto& item : mItems) {
-    if (item.mNot)
-      continue;
-    switch (item.mType) {
-    case MatchType::kFuzzy:
-      switch (item.mText.size()) {
-      default:
-        sum += fzx::score(item.mText, s);
-        break;
-      case 1:
-        sum += fzx::score1(item.mText, s);
-        break;
+bool Query::match(std::string_view s, bool ascii) const
+{
+  Chars chars { s };
+  return matchPlan(s, ascii, chars);
+}
+
+Score Query::score(std::string_view s, bool ascii) const
+{
+  Chars chars { s };
+  return scorePlan(s, ascii, chars);
+}
+
+bool Query::matchScore(std::string_view s, bool ascii, Score& score) const
+{
+  Chars chars { s };
+  if (!matchPlan(s, ascii, chars))
+    return false;
+  score = scorePlan(s, ascii, chars);
+  return true;
+}
+
+void Query::score(const std::string_view* s, Score* scores, size_t n) const
+{
+  std::fill_n(scores, n, Score { 0 });
+  if (mScorePlan.empty())
+    return;
+
+  for (const auto& step : mScorePlan) {
+    const Item& item = mItems[step.mItem];
+    size_t i = 0;
 #if defined(FZX_SSE2)
-      case 2:
-      case 3:
-      case 4:
-        sum += fzx::scoreSSE<4>(item.mText, s);
-        break;
-      case 5:
-      case 6:
-      case 7:
-      case 8:
-        sum += fzx::scoreSSE<8>(item.mText, s);
-        break;
-      case 9:
-      case 10:
-      case 11:
-      case 12:
-        sum += fzx::scoreSSE<12>(item.mText, s);
-        break;
-      case 13:
-      case 14:
-      case 15:
-      case 16:
-        sum += fzx::scoreSSE<16>(item.mText, s);
-        break;
-#elif defined(FZX_NEON)
-      case 2:
-      case 3:
-      case 4:
-        sum += fzx::scoreNeon<4>(item.mText, s);
-        break;
-      case 5:
-      case 6:
-      case 7:
-      case 8:
-        sum += fzx::scoreNeon<8>(item.mText, s);
-        break;
-      case 9:
-      case 10:
-      case 11:
-      case 12:
-        sum += fzx::scoreNeon<12>(item.mText, s);
-        break;
-      case 13:
-      case 14:
-      case 15:
-      case 16:
-        sum += fzx::scoreNeon<16>(item.mText, s);
-        break;
-#endif
+    if (step.mBatch != nullptr) {
+      Score tmp[kScoreBatch];
+      for (; i + kScoreBatch <= n; i += kScoreBatch) {
+        step.mBatch(item.mText, s + i, tmp);
+        for (size_t j = 0; j < kScoreBatch; ++j)
+          scores[i + j] += tmp[j];
       }
-      ++div;
-      break;
-    case MatchType::kSubstr:
-    case MatchType::kBegin:
-    case MatchType::kEnd:
-    case MatchType::kExact:
-      break;
     }
+#endif
+    for (; i < n; ++i)
+      scores[i] += step.mScore(item.mText, s[i]);
   }
 
-  if (div == 0)
-    return 0;
-  return sum / static_cast<Score>(div);
+  for (size_t i = 0; i < n; ++i)
+    scores[i] /= static_cast<Score>(mScorePlan.size());
 }
 
 void Query::matchPositions(std::string_view s, std::vector<bool>& positions) const
@@ -177,16 +487,42 @@ void Query::matchPositions(std::string_view s, std::vector<bool>& positions) con
   DEBUG_ASSERT(match(s));
   positions.clear();
   positions.resize(s.size());
+
+  if (!isAscii(s)) {
+    // Find positions of the characters, then mark all of their bytes
+    thread_local std::u32string chars;
+    thread_local std::vector<uint32_t> offsets;
+    thread_local std::vector<bool> charPositions;
+    decodeUtf8(s, chars, &offsets);
+    charPositions.assign(chars.size(), false);
+    for (const auto& item : mItems) {
+      if (item.mNot)
+        continue;
+      if (item.mType == MatchType::kFuzzy) {
+        fzx::matchPositionsUnicode(item.mChars, chars, &charPositions, item.mCaseSensitive);
+      } else {
+        const int start = matchUnicode(item, chars);
+        DEBUG_ASSERT(start != -1);
+        std::fill_n(charPositions.begin() + start, item.mChars.size(), true);
+      }
+    }
+    for (size_t i = 0; i < chars.size(); ++i)
+      if (charPositions[i])
+        std::fill(positions.begin() + offsets[i], positions.begin() + offsets[i + 1], true);
+    return;
+  }
+
   for (const auto& item : mItems) {
     if (item.mNot)
       continue;
     switch (item.mType) {
     case MatchType::kFuzzy:
-      fzx::matchPositions(item.mText.str(), s, &positions);
+      fzx::matchPositions(item.mText.str(), s, &positions, item.mCaseSensitive);
       break;
     case MatchType::kSubstr: {
       DEBUG_ASSERT(s.size() >= item.mText.size());
-      int start = matchSubstrIndex(item.mText, s);
+      int start = item.mCaseSensitive ? matchSubstrIndex<true>(item.mText, s)
+                                      : matchSubstrIndex<false>(item.mText, s);
       DEBUG_ASSERT(start != -1);
       auto it = positions.begin() + start;
       for (size_t i = 0; i < item.mText.size(); ++i)
@@ -215,4 +551,19 @@ void Query::matchPositions(std::string_view s, std::vector<bool>& positions) con
   }
 }
 
+void Query::matchRanges(std::string_view s, std::vector<MatchRange>& ranges) const
+{
+  thread_local std::vector<bool> positions;
+  matchPositions(s, positions);
+  const auto size = static_cast<uint32_t>(positions.size());
+  for (uint32_t i = 0; i < size; ++i) {
+    if (!positions[i])
+      continue;
+    const uint32_t begin = i;
+    while (i < size && positions[i])
+      ++i;
+    ranges.push_back({ begin, i });
+  }
+}
+
 } // namespace fzx
@@ -1,12 +1,15 @@
 #pragma once
 
 #include <cstdint>
+#include <string>
 #include <utility>
 #include <vector>
 
 #include "fzx/aligned_string.hpp"
 #include "fzx/match.hpp"
 #include "fzx/score.hpp"
+#include "fzx/strings.hpp"
+#include "fzx/unicode.hpp"
 
 namespace fzx {
 
@@ -18,50 +21,156 @@ enum class MatchType : uint8_t {
   kExact, ///< `^foo$`
 };
 
+enum class CaseMode : uint8_t {
+  kInsensitive,
+  kSensitive,
+  kSmart, ///< Case sensitive only for terms with uppercase letters
+};
+
+/// Matched part of a string, byte offsets [mBegin, mEnd).
+struct MatchRange
+{
+  uint32_t mBegin;
+  uint32_t mEnd;
+
+  friend bool operator==(MatchRange a, MatchRange b) noexcept
+  {
+    return a.mBegin == b.mBegin && a.mEnd == b.mEnd;
+  }
+  friend bool operator!=(MatchRange a, MatchRange b) noexcept { return !(a == b); }
+};
+
 struct Query
 {
   struct Item
   {
     MatchType mType;
     bool mNot;
+    bool mAscii; ///< Text has only ASCII characters, see fzx::isAscii
+    bool mCaseSensitive;
     AlignedString mText; // TODO: arena allocator
-
-    Item(MatchType type, AlignedString text, bool negated = false)
-      : mType(type), mNot(negated), mText(std::move(text)) { }
-
-    friend bool operator==(const Item& a, const Item& b) noexcept
+    std::u32string mChars; ///< Decoded text, case folded unless the term is case sensitive
+
+    Item(MatchType type, AlignedString text, bool negated = false, bool caseSensitive = false)
+      : mType(type)
+      , mNot(negated)
+      , mAscii(isAscii(text))
+      , mCaseSensitive(caseSensitive)
+      , mText(std::move(text))
     {
-      return a.mType == b.mType && a.mNot == b.mNot && a.mText == b.mText;
+      decodeUtf8(mText, mChars);
+      if (!mCaseSensitive)
+        for (auto& ch : mChars)
+          ch = foldCase(ch);
     }
 
-    friend bool operator!=(const Item& a, const Item& b) noexcept
+    friend bool operator==(const Item& a, const Item& b) noexcept
     {
-      return a.mType != b.mType || a.mNot != b.mNot || a.mText != b.mText;
+      return a.mType == b.mType && a.mNot == b.mNot && a.mCaseSensitive == b.mCaseSensitive
+          && a.mText == b.mText;
     }
+
+    friend bool operator!=(const Item& a, const Item& b) noexcept { return !(a == b); }
   };
 
-  void clear() noexcept { mItems.clear(); }
+  void clear() noexcept
+  {
+    mItems.clear();
+    mMatchPlan.clear();
+    mScorePlan.clear();
+    mCharMask = 0;
+  }
+
+  /// Case mode of the terms added from now on.
+  void setCaseMode(CaseMode caseMode) noexcept { mCaseMode = caseMode; }
+  [[nodiscard]] CaseMode caseMode() const noexcept { return mCaseMode; }
 
   void add(AlignedString text, MatchType type = MatchType::kFuzzy, bool negated = false)
   {
-    mItems.emplace_back(type, std::move(text), negated);
+    if (!negated)
+      mCharMask |= charMask(text);
+    const bool caseSensitive = mCaseMode == CaseMode::kSensitive
+        || (mCaseMode == CaseMode::kSmart && hasUppercase(text));
+    mItems.emplace_back(type, std::move(text), negated, caseSensitive);
+    compile();
   }
 
-  [[nodiscard]] static Query parse(std::string_view s);
+  [[nodiscard]] static Query parse(std::string_view s, CaseMode caseMode = CaseMode::kInsensitive);
 
   [[nodiscard]] bool empty() const noexcept { return mItems.empty(); }
   [[nodiscard]] const std::vector<Item>& items() const noexcept { return mItems; }
 
-  [[nodiscard]] bool match(std::string_view s) const;
-  [[nodiscard]] Score score(std::string_view s) const;
+  /// Check if every string matching this query also matches `prev`, ie. whether this query is
+  /// a narrowing of `prev`. In that case only the results of `prev` have to be filtered again.
+  [[nodiscard]] bool refines(const Query& prev) const;
+
+  /// Quick check whether a string with the given fzx::charMask can match at all. Every term
+  /// that isn't negated needs all of its characters in the string. If this returns true, the
+  /// string still has to be checked with match.
+  [[nodiscard]] bool mayMatch(uint64_t charMask) const noexcept
+  {
+    return (charMask & mCharMask) == mCharMask;
+  }
+  [[nodiscard]] bool match(std::string_view s) const { return match(s, isAscii(s)); }
+  /// Same as match, `ascii` tells whether `s` has only ASCII characters, see Items::isAscii.
+  /// Strings with other characters are matched by characters instead of bytes.
+  [[nodiscard]] bool match(std::string_view s, bool ascii) const;
+  [[nodiscard]] Score score(std::string_view s) const { return score(s, isAscii(s)); }
+  [[nodiscard]] Score score(std::string_view s, bool ascii) const;
+  /// Same as match followed by score, if it matches. Strings with non-ASCII characters are
+  /// decoded only once for both.
+  [[nodiscard]] bool matchScore(std::string_view s, bool ascii, Score& score) const;
+  /// Score `n` strings at once, same as calling score for each of them.
+  /// Some terms can be scored for multiple strings in parallel.
+  /// Precondition: strings have only ASCII characters, and at least 16 bytes past them have to
+  /// be readable, see kOveralloc.
+  void score(const std::string_view* s, Score* scores, size_t n) const;
+  /// Positions are set for every byte of the matched characters.
   /// Precondition: match(s) == true
   void matchPositions(std::string_view s, std::vector<bool>& positions) const;
+  /// Same as matchPositions, as sorted ranges of consecutive matched bytes that don't touch each
+  /// other. Ranges are appended to `ranges`, so ranges of many strings can be collected in one.
+  /// Precondition: match(s) == true
+  void matchRanges(std::string_view s, std::vector<MatchRange>& ranges) const;
 
   friend bool operator==(const Query& a, const Query& b) noexcept { return a.mItems == b.mItems; }
   friend bool operator!=(const Query& a, const Query& b) noexcept { return a.mItems != b.mItems; }
 
 private:
+  using MatchFn = bool (*)(const AlignedString& needle, std::string_view haystack) noexcept;
+  using ScoreFn = Score (*)(const AlignedString& needle, std::string_view haystack) noexcept;
+  using ScoreBatchFn = void (*)(const AlignedString& needle,
+                                const std::string_view* haystacks,
+                                Score* scores) noexcept;
+
+  /// Term of the compiled query, with the kernels picked up front.
+  struct MatchStep
+  {
+    uint32_t mItem; ///< Index to mItems
+    MatchFn mMatch; ///< Matcher for ASCII terms, null for the others
+  };
+
+  /// Fuzzy term that isn't negated, the only ones that are scored.
+  struct ScoreStep
+  {
+    uint32_t mItem; ///< Index to mItems
+    ScoreFn mScore; ///< For ASCII strings
+    ScoreBatchFn mBatch; ///< Scores kScoreBatch ASCII strings at once, can be null
+  };
+
+  struct Chars;
+
+  /// Build mMatchPlan and mScorePlan from mItems.
+  void compile();
+  [[nodiscard]] bool matchPlan(std::string_view s, bool ascii, Chars& chars) const;
+  [[nodiscard]] Score scorePlan(std::string_view s, bool ascii, Chars& chars) const;
+
   std::vector<Item> mItems;
+  /// Terms in the order they are matched, the cheap and selective ones go first.
+  std::vector<MatchStep> mMatchPlan;
+  std::vector<ScoreStep> mScorePlan;
+  uint64_t mCharMask { 0 }; ///< Characters required by the terms, see mayMatch
+  CaseMode mCaseMode { CaseMode::kInsensitive };
 };
 
 } // namespace fzx
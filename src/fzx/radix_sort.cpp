@@ -0,0 +1,75 @@
+// Licensed under LGPLv3 - see LICENSE file for details.
+
+#include "fzx/radix_sort.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+#include "fzx/macros.hpp"
+
+namespace fzx {
+
+namespace {
+
+/// Below this size std::sort is faster than building the histograms.
+constexpr size_t kMinRadixSize = 1024;
+
+constexpr size_t kDigits = sizeof(uint64_t);
+constexpr size_t kBuckets = 256;
+
+using Histogram = std::array<std::array<size_t, kBuckets>, kDigits>;
+
+[[nodiscard]] INLINE size_t digit(uint64_t key, size_t d) noexcept
+{
+  return (key >> (d * 8)) & (kBuckets - 1);
+}
+
+} // namespace
+
+void radixSort(std::vector<MatchedItem>& items, std::vector<MatchedItem>& tmp)
+{
+  const size_t size = items.size();
+  if (size < kMinRadixSize) {
+    std::sort(items.begin(), items.end());
+    return;
+  }
+
+  // Histograms of all the digits at once, so that the items are read only once for them.
+  Histogram hist {};
+  for (const MatchedItem item : items) {
+    const uint64_t k = item.key();
+    for (size_t d = 0; d < kDigits; ++d)
+      ++hist[d][digit(k, d)];
+  }
+
+  tmp.resize(size);
+  MatchedItem* src = items.data();
+  MatchedItem* dst = tmp.data();
+  const uint64_t first = items.front().key();
+  for (size_t d = 0; d < kDigits; ++d) {
+    auto& counts = hist[d];
+    // All the items are in one bucket, this pass wouldn't change their order.
+    if (counts[digit(first, d)] == size)
+      continue;
+
+    size_t offset = 0;
+    for (auto& count : counts) {
+      const size_t n = count;
+      count = offset;
+      offset += n;
+    }
+    for (size_t i = 0; i < size; ++i) {
+      const MatchedItem item = src[i];
+      dst[counts[digit(item.key(), d)]++] = item;
+    }
+    std::swap(src, dst);
+  }
+
+  // Odd number of passes, the sorted items ended up in the scratch vector.
+  if (src != items.data())
+    items.swap(tmp);
+}
+
+} // namespace fzx
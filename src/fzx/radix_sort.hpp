@@ -0,0 +1,17 @@
+// Licensed under LGPLv3 - see LICENSE file for details.
+
+#pragma once
+
+#include <vector>
+
+#include "fzx/matched_item.hpp"
+
+namespace fzx {
+
+/// Sort `items` with an LSD radix sort over MatchedItem::key, one byte per pass. Bytes that are
+/// the same in every item are skipped, which is most of the score bytes, as scores of one query
+/// are within a narrow range. `tmp` is scratch space, it's kept by the caller so that sorting
+/// repeatedly doesn't allocate. Small vectors are sorted with std::sort.
+void radixSort(std::vector<MatchedItem>& items, std::vector<MatchedItem>& tmp);
+
+} // namespace fzx
@@ -0,0 +1,136 @@
+// Licensed under LGPLv3 - see LICENSE file for details.
+
+#include "fzx/rc_mem.hpp"
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <system_error>
+
+#if !defined(_WIN32)
+extern "C" {
+# include <fcntl.h>
+# include <sys/mman.h>
+# include <sys/stat.h>
+# include <unistd.h>
+}
+#endif
+
+namespace fzx {
+
+namespace {
+
+[[noreturn]] void throwSystemError(int err, const char* what)
+{
+  throw std::system_error { err, std::generic_category(), what };
+}
+
+} // namespace
+
+#if !defined(_WIN32)
+
+namespace {
+
+size_t pageSize() noexcept
+{
+  static const auto size = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+  return size;
+}
+
+} // namespace
+
+RcMem RcMem::mapFile(const char* path, size_t overalloc, size_t& size)
+{
+  const int fd = ::open(path, O_RDONLY | O_CLOEXEC);
+  if (fd == -1)
+    throwSystemError(errno, "open");
+
+  auto fail = [fd](const char* what) {
+    const int err = errno;
+    ::close(fd);
+    throwSystemError(err, what);
+  };
+
+  struct stat st {};
+  if (::fstat(fd, &st) == -1)
+    fail("fstat");
+  if (!S_ISREG(st.st_mode)) {
+    errno = EINVAL;
+    fail("mapFile");
+  }
+
+  // The first page holds only the control block, right before the contents. The file is mapped
+  // over an anonymous mapping, so whatever follows the file is readable and filled with zeros.
+  const size_t page = pageSize();
+  const auto fileSize = static_cast<size_t>(st.st_size);
+  const size_t mapSize = page + (fileSize + overalloc + page - 1) / page * page;
+  void* base = ::mmap(nullptr, mapSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (base == MAP_FAILED)
+    fail("mmap");
+  auto* mem = static_cast<uint8_t*>(base);
+  if (fileSize != 0) {
+    void* file = ::mmap(mem + page, fileSize, PROT_READ, MAP_PRIVATE | MAP_FIXED, fd, 0);
+    if (file == MAP_FAILED) {
+      const int err = errno;
+      ::munmap(base, mapSize);
+      errno = err;
+      fail("mmap");
+    }
+  }
+  ::close(fd);
+
+  auto* ptr = mem + page - sizeof(ControlBlock);
+  auto* cb = new (ptr) ControlBlock {};
+  cb->mMapSize = mapSize;
+
+  size = fileSize;
+  RcMem r {};
+  r.mPtr = ptr;
+  return r;
+}
+
+void RcMem::unmap(uint8_t* p) noexcept
+{
+  const ControlBlock& cb = *std::launder(reinterpret_cast<ControlBlock*>(p));
+  ::munmap(p + sizeof(ControlBlock) - pageSize(), cb.mMapSize);
+}
+
+#else
+
+// TODO: use file mapping on windows, just read the whole file for now
+RcMem RcMem::mapFile(const char* path, size_t overalloc, size_t& size)
+{
+  std::FILE* file = std::fopen(path, "rb");
+  if (file == nullptr)
+    throwSystemError(errno, "fopen");
+
+  auto fail = [file](const char* what) {
+    const int err = errno;
+    std::fclose(file);
+    throwSystemError(err, what);
+  };
+
+  if (std::fseek(file, 0, SEEK_END) != 0)
+    fail("fseek");
+  const long end = std::ftell(file);
+  if (end < 0)
+    fail("ftell");
+  if (std::fseek(file, 0, SEEK_SET) != 0)
+    fail("fseek");
+
+  const auto fileSize = static_cast<size_t>(end);
+  auto r = create(fileSize + overalloc);
+  if (std::fread(r.data(), 1, fileSize, file) != fileSize)
+    fail("fread");
+  std::fclose(file);
+  std::memset(r.data() + fileSize, 0, overalloc);
+
+  size = fileSize;
+  return r;
+}
+
+void RcMem::unmap(uint8_t*) noexcept { }
+
+#endif
+
+} // namespace fzx
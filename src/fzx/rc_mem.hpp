@@ -24,6 +24,7 @@ class RcMem
   struct alignas(kAlign) ControlBlock
   {
     std::atomic<size_t> mRef { 1 };
+    size_t mMapSize { 0 }; ///< Size of the whole mapping if created with mapFile, otherwise 0
   };
 
   static_assert(std::is_trivially_destructible_v<ControlBlock>);
@@ -44,6 +45,12 @@ public:
     return r;
   }
 
+  /// Map a file into memory, read-only. The contents are followed by at least `overalloc`
+  /// readable zero bytes. Size of the file is stored in `size`.
+  ///
+  /// Throws std::system_error when the file can't be mapped.
+  [[nodiscard]] static RcMem mapFile(const char* path, size_t overalloc, size_t& size);
+
   RcMem() noexcept = default;
 
   RcMem(const RcMem& b) noexcept : mPtr(b.mPtr) { ref(mPtr); }
@@ -110,11 +117,17 @@ private:
   {
     if (p != nullptr) {
       ControlBlock& cb = *std::launder(reinterpret_cast<ControlBlock*>(p));
-      if (cb.mRef.fetch_sub(1, std::memory_order_acq_rel) == 1)
-        alignedFree(p);
+      if (cb.mRef.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+        if (cb.mMapSize != 0)
+          unmap(p);
+        else
+          alignedFree(p);
+      }
     }
   }
 
+  static void unmap(uint8_t* p) noexcept;
+
 private:
   uint8_t* mPtr { nullptr };
 };
@@ -0,0 +1,61 @@
+// Licensed under LGPLv3 - see LICENSE file for details.
+
+#include "fzx/results_cache.hpp"
+
+#include <algorithm>
+#include <iterator>
+
+#include "fzx/config.hpp"
+
+namespace fzx {
+
+namespace {
+
+/// Move the entry at `it` to the front.
+template <typename It>
+It touch(It begin, It it)
+{
+  std::rotate(begin, it, std::next(it));
+  return begin;
+}
+
+} // namespace
+
+const ResultsCache::Entry* ResultsCache::find(const Query& query, size_t itemsSize, size_t limit)
+{
+  auto it = std::find_if(mEntries.begin(), mEntries.end(),
+                         [&](const Entry& e) { return *e.mQuery == query; });
+  if (it == mEntries.end() || it->mItemsTick > itemsSize)
+    return nullptr;
+  // The best `limit` results out of the truncated ones are still the best ones overall.
+  const size_t size = it->mItems->size();
+  if (size != it->mMatched && (limit == 0 || size < limit))
+    return nullptr;
+  return &*touch(mEntries.begin(), it);
+}
+
+void ResultsCache::insert(const std::shared_ptr<Query>& query,
+                          std::shared_ptr<const std::vector<MatchedItem>> items,
+                          size_t matched,
+                          size_t itemsTick)
+{
+  auto it = std::find_if(mEntries.begin(), mEntries.end(),
+                         [&](const Entry& e) { return *e.mQuery == *query; });
+  if (it != mEntries.end()) {
+    it = touch(mEntries.begin(), it);
+    // Results that came from this entry, possibly truncated even more.
+    const Entry& e = *it;
+    if (e.mItemsTick == itemsTick && e.mMatched == matched && e.mItems->size() >= items->size())
+      return;
+  } else {
+    if (mEntries.size() == kResultsCacheSize)
+      mEntries.pop_back();
+    it = mEntries.emplace(mEntries.begin());
+  }
+  it->mQuery = query;
+  it->mItems = std::move(items);
+  it->mMatched = matched;
+  it->mItemsTick = itemsTick;
+}
+
+} // namespace fzx
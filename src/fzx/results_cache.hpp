@@ -0,0 +1,53 @@
+// Licensed under LGPLv3 - see LICENSE file for details.
+
+#pragma once
+
+#include <cstddef>
+#include <memory>
+#include <vector>
+
+#include "fzx/matched_item.hpp"
+#include "fzx/query.hpp"
+
+namespace fzx {
+
+/// Results of recently active queries, least recently used ones are dropped first.
+///
+/// Items are only ever appended, so results for the first N items stay valid for as long as the
+/// items exist. Results found in the cache can be used as they are, only the items appended after
+/// them have to be processed.
+struct ResultsCache
+{
+  struct Entry
+  {
+    std::shared_ptr<const Query> mQuery;
+    /// Sorted results. Shared with the jobs using them.
+    std::shared_ptr<const std::vector<MatchedItem>> mItems;
+    /// Number of matched items. Larger than the size of mItems if the results were truncated.
+    size_t mMatched { 0 };
+    /// Items size the results were computed for.
+    size_t mItemsTick { 0 };
+  };
+
+  /// Find results for `query`, computed for at most `itemsSize` items. Truncated results are
+  /// returned only if they have at least `limit` items, 0 means the results have to be complete.
+  [[nodiscard]] const Entry* find(const Query& query, size_t itemsSize, size_t limit);
+
+  /// Add results for `query`, replacing the previous ones for the same query. The items are
+  /// shared, not copied. Results that came from the cached ones, truncated even more, don't
+  /// replace them.
+  void insert(const std::shared_ptr<Query>& query,
+              std::shared_ptr<const std::vector<MatchedItem>> items,
+              size_t matched,
+              size_t itemsTick);
+
+  [[nodiscard]] size_t size() const noexcept { return mEntries.size(); }
+
+  void clear() noexcept { mEntries.clear(); }
+
+private:
+  /// Most recently used first.
+  std::vector<Entry> mEntries;
+};
+
+} // namespace fzx
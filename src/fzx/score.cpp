@@ -28,14 +28,19 @@
 
 #include <algorithm>
 #include <cstdint>
+#include <cstring>
 #include <limits>
+#include <string_view>
+#include <type_traits>
 #include <utility>
 #include <vector>
 
 #include "fzx/config.hpp"
+#include "fzx/cpu.hpp"
 #include "fzx/macros.hpp"
 #include "fzx/simd.hpp"
 #include "fzx/strings.hpp"
+#include "fzx/unicode.hpp"
 #include "fzx/util.hpp"
 
 namespace fzx {
@@ -86,17 +91,35 @@ void precomputeBonus(std::string_view haystack, Score* matchBonus) noexcept
 
 using ScoreArray = std::array<Score, kMatchMaxLen>;
 
+/// ASCII character of the same class in kBonusIndex and kBonusStates. Other characters are
+/// treated as letters, uppercase if they can be case folded.
+uint8_t bonusChar(char32_t ch) noexcept
+{
+  if (ch < 0x80)
+    return static_cast<uint8_t>(ch);
+  return foldCase(ch) != ch ? 'A' : 'a';
+}
+
+/// Characters are bytes for ASCII strings, and decoded code points otherwise.
+template <typename Char>
 struct MatchStruct
 {
   int mNeedleLen;
   int mHaystackLen;
 
-  char mLowerNeedle[kMatchMaxLen];
-  char mLowerHaystack[kMatchMaxLen];
+  Char mLowerNeedle[kMatchMaxLen];
+  Char mLowerHaystack[kMatchMaxLen];
 
   Score mMatchBonus[kMatchMaxLen];
 
-  MatchStruct(const AlignedString& needle, std::string_view haystack) noexcept;
+  /// Case sensitive matches compare the characters as they are, otherwise they are folded.
+  MatchStruct(const AlignedString& needle,
+              std::string_view haystack,
+              bool caseSensitive = false) noexcept;
+  /// Needle is case folded already, unless the match is case sensitive.
+  MatchStruct(std::u32string_view needle,
+              std::u32string_view haystack,
+              bool caseSensitive = false) noexcept;
 
   inline void matchRow(int row,
                        Score* RESTRICT currD,
@@ -108,24 +131,54 @@ struct MatchStruct
 // "initialize all your variables" they said.
 // and now memset takes up 20% of the runtime of your program.
 // NOLINTNEXTLINE(cppcoreguidelines-pro-type-member-init)
-MatchStruct::MatchStruct(const AlignedString& needle, std::string_view haystack) noexcept
+template <>
+MatchStruct<char>::MatchStruct(const AlignedString& needle,
+                               std::string_view haystack,
+                               bool caseSensitive) noexcept
   : mNeedleLen(static_cast<int>(needle.size())), mHaystackLen(static_cast<int>(haystack.size()))
 {
   if (mHaystackLen > kMatchMaxLen || mNeedleLen > mHaystackLen)
     return;
 
   // TODO: needle can be preprocessed only once
-  toLower(mLowerNeedle, needle.data(), mNeedleLen);
-  toLower(mLowerHaystack, haystack.data(), mHaystackLen);
+  if (caseSensitive) {
+    std::copy_n(needle.data(), mNeedleLen, mLowerNeedle);
+    std::copy_n(haystack.data(), mHaystackLen, mLowerHaystack);
+  } else {
+    toLower(mLowerNeedle, needle.data(), mNeedleLen);
+    toLower(mLowerHaystack, haystack.data(), mHaystackLen);
+  }
 
   precomputeBonus(haystack, mMatchBonus);
 }
 
-void MatchStruct::matchRow(int row,
-                           Score* RESTRICT currD,
-                           Score* RESTRICT currM,
-                           const Score* RESTRICT lastD,
-                           const Score* RESTRICT lastM) noexcept
+// NOLINTNEXTLINE(cppcoreguidelines-pro-type-member-init)
+template <>
+MatchStruct<char32_t>::MatchStruct(std::u32string_view needle,
+                                   std::u32string_view haystack,
+                                   bool caseSensitive) noexcept
+  : mNeedleLen(static_cast<int>(needle.size())), mHaystackLen(static_cast<int>(haystack.size()))
+{
+  if (mHaystackLen > kMatchMaxLen || mNeedleLen > mHaystackLen)
+    return;
+
+  std::copy(needle.begin(), needle.end(), mLowerNeedle);
+  uint8_t lastCh = '/';
+  for (int i = 0; i < mHaystackLen; ++i) {
+    const char32_t ch = haystack[i];
+    const uint8_t bonusCh = bonusChar(ch);
+    mLowerHaystack[i] = caseSensitive ? ch : foldCase(ch);
+    mMatchBonus[i] = kBonusStates[kBonusIndex[bonusCh]][lastCh];
+    lastCh = bonusCh;
+  }
+}
+
+template <typename Char>
+void MatchStruct<Char>::matchRow(int row,
+                                 Score* RESTRICT currD,
+                                 Score* RESTRICT currM,
+                                 const Score* RESTRICT lastD,
+                                 const Score* RESTRICT lastM) noexcept
 {
   Score prevScore = kScoreMin;
   Score gapScore = row == mNeedleLen - 1 ? kScoreGapTrailing : kScoreGapInner;
@@ -149,50 +202,314 @@ void MatchStruct::matchRow(int row,
   }
 }
 
-} // namespace
+/// Score of a needle that is shorter than the haystack, both within kMatchMaxLen.
+template <typename Char>
+Score scoreMatch(MatchStruct<Char>& match) noexcept
+{
+  // D[][] Stores the best score for this position ending with a match.
+  // M[][] Stores the best possible score at this position.
+  ScoreArray d[2];
+  ScoreArray m[2];
 
-Score score(const AlignedString& needle, std::string_view haystack) noexcept
+  Score* lastD = d[0].data();
+  Score* lastM = m[0].data();
+  Score* currD = d[1].data();
+  Score* currM = m[1].data();
+
+  for (int i = 0; i < match.mNeedleLen; ++i) {
+    match.matchRow(i, currD, currM, lastD, lastM);
+    std::swap(currD, lastD);
+    std::swap(currM, lastM);
+  }
+
+  return lastM[match.mHaystackLen - 1];
+}
+
+/// Score of a needle and its positions in the haystack, positions are indexes of characters.
+/// The haystack of `match` starts at `offset` in `positions`.
+template <typename Char>
+Score matchPositionsImpl(MatchStruct<Char>& match, std::vector<bool>* positions, size_t offset)
 {
-  if (needle.empty())
-    return kScoreMin;
+  const int needleLen = match.mNeedleLen;
+  const int haystackLen = match.mHaystackLen;
 
-  if (haystack.size() > kMatchMaxLen || needle.size() > haystack.size()) {
+  if (haystackLen > kMatchMaxLen || needleLen > haystackLen) {
     // Unreasonably large candidate: return no score
     // If it is a valid match it will still be returned, it will
     // just be ranked below any reasonably sized candidates
     return kScoreMin;
-  } else if (needle.size() == haystack.size()) {
+  } else if (needleLen == haystackLen) {
     // Since this method can only be called with a haystack which
     // matches needle. If the lengths of the strings are equal the
     // strings themselves must also be equal (ignoring case).
+    if (positions)
+      std::fill_n(positions->begin() + static_cast<ptrdiff_t>(offset), haystackLen, true);
     return kScoreMax;
   }
 
-  MatchStruct match { needle, haystack };
-
   // D[][] Stores the best score for this position ending with a match.
   // M[][] Stores the best possible score at this position.
-  ScoreArray d[2];
-  ScoreArray m[2];
+  // Kept around, positions are usually found for many strings in a row.
+  thread_local std::vector<ScoreArray> d;
+  thread_local std::vector<ScoreArray> m;
+  if (d.size() < static_cast<size_t>(needleLen)) {
+    d.resize(needleLen);
+    m.resize(needleLen);
+  }
 
-  Score* lastD = d[0].data();
-  Score* lastM = m[0].data();
-  Score* currD = d[1].data();
-  Score* currM = m[1].data();
+  Score* lastD = nullptr;
+  Score* lastM = nullptr;
+  Score* currD = nullptr;
+  Score* currM = nullptr;
+
+  for (int i = 0; i < needleLen; ++i) {
+    currD = d[i].data();
+    currM = m[i].data();
 
-  for (int i = 0; i < match.mNeedleLen; ++i) {
     match.matchRow(i, currD, currM, lastD, lastM);
-    std::swap(currD, lastD);
-    std::swap(currM, lastM);
+
+    lastD = currD;
+    lastM = currM;
   }
 
-  return lastM[match.mHaystackLen - 1];
+  // backtrace to find the positions of optimal matching
+  if (positions) {
+    bool matchRequired = false;
+    for (int i = needleLen - 1, j = haystackLen - 1; i >= 0; --i) {
+      for (; j >= 0; --j) {
+        // There may be multiple paths which result in
+        // the optimal weight.
+        //
+        // For simplicity, we will pick the first one
+        // we encounter, the latest in the candidate
+        // string.
+        if (d[i][j] != kScoreMin && (matchRequired || d[i][j] == m[i][j])) {
+          // If this score was determined using
+          // kScoreMatchConsecutive, the
+          // previous character MUST be a match
+          matchRequired = i && j && m[i][j] == d[i - 1][j - 1] + kScoreMatchConsecutive;
+          positions->at(offset + j--) = true;
+          break;
+        }
+      }
+    }
+  }
+
+  return m[needleLen - 1][haystackLen - 1];
+}
+
+/// Part of a haystack that is enough to score a needle, see scoreWindow.
+template <typename Char>
+struct ScoreWindow
+{
+  std::basic_string_view<Char> mStr;
+  Score mGaps; ///< Score of the leading and trailing gaps that were cut off
+};
+
+/// Every match lies between `first`, the first occurrence of the first needle character, and
+/// `end`, past the last occurrence of the last one. What is around only adds leading and trailing
+/// gaps, so only that part has to be scored, and the gaps are added to its score afterwards. This
+/// gives the same score as the whole haystack. One more character is kept in front, the bonus of
+/// the first one depends on it.
+template <typename Char>
+ScoreWindow<Char> makeWindow(std::basic_string_view<Char> haystack,
+                             size_t needleLen,
+                             size_t first,
+                             size_t end) noexcept
+{
+  const size_t begin = first > 0 ? first - 1 : 0;
+  // No match, or nothing to cut off. A window as long as the needle would be scored as equal.
+  if (first >= end || end - begin <= needleLen)
+    return { haystack, 0 };
+  return { haystack.substr(begin, end - begin),
+           (static_cast<Score>(begin) * kScoreGapLeading)
+               + (static_cast<Score>(haystack.size() - end) * kScoreGapTrailing) };
+}
+
+ScoreWindow<char> scoreWindow(std::string_view needle,
+                              std::string_view haystack,
+                              bool caseSensitive = false) noexcept
+{
+  // Kernels handle these on their own
+  if (needle.empty() || needle.size() >= haystack.size())
+    return { haystack, 0 };
+
+  // Unless the case matters, the first character is looked up as both lower and upper case
+  const char* const hs = haystack.data();
+  const char lower = caseSensitive ? needle[0] : toLower(needle[0]);
+  const char upper = caseSensitive ? needle[0] : toUpper(needle[0]);
+  size_t first = haystack.size();
+  if (const void* p = std::memchr(hs, lower, first); p != nullptr)
+    first = static_cast<size_t>(static_cast<const char*>(p) - hs);
+  if (upper != lower)
+    if (const void* p = std::memchr(hs, upper, first); p != nullptr)
+      first = static_cast<size_t>(static_cast<const char*>(p) - hs);
+
+  auto fold = [caseSensitive](char ch) { return caseSensitive ? ch : toLower(ch); };
+  const char last = fold(needle[needle.size() - 1]);
+  size_t end = haystack.size();
+  while (end > first && fold(hs[end - 1]) != last)
+    --end;
+
+  return makeWindow(haystack, needle.size(), first, end);
+}
+
+ScoreWindow<char32_t> scoreWindow(std::u32string_view needle,
+                                  std::u32string_view haystack,
+                                  bool caseSensitive) noexcept
+{
+  if (needle.empty() || needle.size() >= haystack.size())
+    return { haystack, 0 };
+
+  auto fold = [caseSensitive](char32_t ch) { return caseSensitive ? ch : foldCase(ch); };
+  size_t first = 0;
+  while (first < haystack.size() && fold(haystack[first]) != needle[0])
+    ++first;
+  size_t end = haystack.size();
+  while (end > first && fold(haystack[end - 1]) != needle[needle.size() - 1])
+    --end;
+
+  return makeWindow(haystack, needle.size(), first, end);
+}
+
+uint8_t bonusChar(char ch) noexcept
+{
+  return static_cast<uint8_t>(ch);
+}
+
+char foldChar(char ch) noexcept
+{
+  return toLower(ch);
+}
+
+char32_t foldChar(char32_t ch) noexcept
+{
+  return foldCase(ch);
+}
+
+/// ASCII case folding of the scorers, the character as it is when the match is case sensitive.
+template <bool kCaseSensitive, typename T>
+INLINE T foldAscii(T ch) noexcept
+{
+  if constexpr (kCaseSensitive)
+    return ch;
+  else
+    return toLower(ch);
+}
+
+/// Same as scoreMatch, for haystacks too long for MatchStruct. The DP goes over the haystack one
+/// character at a time, like the SIMD kernels do, and keeps only the scores of the previous
+/// character for each needle character. A char32_t needle is case folded already, unless the
+/// match is case sensitive.
+template <typename Char>
+Score scoreStream(std::basic_string_view<Char> needle,
+                  std::basic_string_view<Char> haystack,
+                  bool caseSensitive) noexcept
+{
+  const size_t needleLen = needle.size();
+  if (needleLen > kMatchMaxLen)
+    return kScoreMin;
+
+  Char lowerNeedle[kMatchMaxLen]; // NOLINT(cppcoreguidelines-pro-type-member-init)
+  Score d[kMatchMaxLen]; // NOLINT(cppcoreguidelines-pro-type-member-init)
+  Score m[kMatchMaxLen]; // NOLINT(cppcoreguidelines-pro-type-member-init)
+  for (size_t i = 0; i < needleLen; ++i) {
+    lowerNeedle[i] = caseSensitive || std::is_same_v<Char, char32_t> ? needle[i]
+                                                                     : foldChar(needle[i]);
+    d[i] = kScoreMin;
+    m[i] = kScoreMin;
+  }
+
+  uint8_t lastCh = '/';
+  Score g = 0; // Leading gap score
+  for (const Char hch : haystack) {
+    const Char ch = caseSensitive ? hch : foldChar(hch);
+    const uint8_t bonusCh = bonusChar(hch);
+    const Score bonus = kBonusStates[kBonusIndex[bonusCh]][lastCh];
+    lastCh = bonusCh;
+
+    // Go backwards, so the previous row still has the scores from the previous character
+    for (size_t i = needleLen; i-- > 0;) {
+      Score s = kScoreMin;
+      if (lowerNeedle[i] == ch)
+        s = i == 0 ? g + bonus : std::max(m[i - 1] + bonus, d[i - 1] + kScoreMatchConsecutive);
+      d[i] = s;
+      m[i] = std::max(s, m[i] + (i == needleLen - 1 ? kScoreGapTrailing : kScoreGapInner));
+    }
+    g += kScoreGapLeading;
+  }
+
+  return m[needleLen - 1];
 }
 
+/// Same as scoring, only the part of the haystack where the needle can match is searched for
+/// positions. If it doesn't fit in kMatchMaxLen, only the score is found.
+template <typename Char>
+Score matchPositionsWindow(std::basic_string_view<Char> needle,
+                           std::basic_string_view<Char> haystack,
+                           std::vector<bool>* positions,
+                           bool caseSensitive)
+{
+  const auto window = scoreWindow(needle, haystack, caseSensitive);
+  if (window.mStr.size() > kMatchMaxLen)
+    return scoreStream(needle, window.mStr, caseSensitive) + window.mGaps;
+
+  MatchStruct<Char> match { needle, window.mStr, caseSensitive };
+  const auto offset = static_cast<size_t>(window.mStr.data() - haystack.data());
+  return matchPositionsImpl(match, positions, offset) + window.mGaps;
+}
+
+} // namespace
+
+template <bool kCaseSensitive>
+Score score(const AlignedString& needle, std::string_view haystack) noexcept
+{
+  if (needle.empty())
+    return kScoreMin;
+
+  if (needle.size() > haystack.size()) {
+    return kScoreMin;
+  } else if (needle.size() == haystack.size()) {
+    // Since this method can only be called with a haystack which
+    // matches needle. If the lengths of the strings are equal the
+    // strings themselves must also be equal (ignoring case).
+    return kScoreMax;
+  }
+
+  const auto window = scoreWindow(needle, haystack, kCaseSensitive);
+  if (window.mStr.size() > kMatchMaxLen)
+    return scoreStream<char>(needle, window.mStr, kCaseSensitive) + window.mGaps;
+  MatchStruct<char> match { needle, window.mStr, kCaseSensitive };
+  return scoreMatch(match) + window.mGaps;
+}
+
+template Score score<false>(const AlignedString& needle, std::string_view haystack) noexcept;
+template Score score<true>(const AlignedString& needle, std::string_view haystack) noexcept;
+
+Score scoreUnicode(std::u32string_view needle,
+                   std::u32string_view haystack,
+                   bool caseSensitive) noexcept
+{
+  // Same as fzx::score
+  if (needle.empty())
+    return kScoreMin;
+  if (needle.size() > haystack.size())
+    return kScoreMin;
+  if (needle.size() == haystack.size())
+    return kScoreMax;
+
+  const auto window = scoreWindow(needle, haystack, caseSensitive);
+  if (window.mStr.size() > kMatchMaxLen)
+    return scoreStream(needle, window.mStr, caseSensitive) + window.mGaps;
+  MatchStruct<char32_t> match { needle, window.mStr, caseSensitive };
+  return scoreMatch(match) + window.mGaps;
+}
+
+template <bool kCaseSensitive>
 Score score1(const AlignedString& needle, std::string_view haystack) noexcept
 {
   DEBUG_ASSERT(needle.size() == 1);
-  if (needle.empty() || haystack.size() > kMatchMaxLen || haystack.empty()) {
+  if (needle.empty() || haystack.empty()) {
     return kScoreMin;
   } else if (haystack.size() == 1) {
     return kScoreMax;
@@ -200,14 +517,16 @@ Score score1(const AlignedString& needle, std::string_view haystack) noexcept
 
   // Surely this isn't optimal and could be optimized further.
 
+  const auto window = scoreWindow(needle, haystack, kCaseSensitive);
+  haystack = window.mStr;
   const int haystackLen = static_cast<int>(haystack.size());
-  const uint8_t lowerNeedle = toLower(needle[0]);
+  const uint8_t lowerNeedle = foldAscii<kCaseSensitive>(static_cast<uint8_t>(needle[0]));
   uint8_t lastCh = '/';
   Score score = kScoreMin;
 
   {
     uint8_t ch = haystack[0];
-    if (lowerNeedle == toLower(ch)) {
+    if (lowerNeedle == foldAscii<kCaseSensitive>(ch)) {
       Score bonus = kBonusStates[kBonusIndex[ch]][lastCh];
       score = bonus;
     }
@@ -217,7 +536,7 @@ Score score1(const AlignedString& needle, std::string_view haystack) noexcept
   for (int i = 1; i < haystackLen; ++i) {
     uint8_t ch = haystack[i];
     score += kScoreGapTrailing;
-    if (lowerNeedle == toLower(ch)) {
+    if (lowerNeedle == foldAscii<kCaseSensitive>(ch)) {
       Score bonus = kBonusStates[kBonusIndex[ch]][lastCh];
       if (Score ns = (static_cast<Score>(i) * kScoreGapLeading) + bonus; ns > score)
         score = ns;
@@ -225,28 +544,54 @@ Score score1(const AlignedString& needle, std::string_view haystack) noexcept
     lastCh = ch;
   }
 
-  return score;
+  return score + window.mGaps;
 }
 
+template Score score1<false>(const AlignedString& needle, std::string_view haystack) noexcept;
+template Score score1<true>(const AlignedString& needle, std::string_view haystack) noexcept;
+
 #if defined(FZX_SSE2) || defined(FZX_NEON)
 namespace {
 alignas(32) constexpr Score kGapTable[7] {
   kScoreGapInner, kScoreGapInner, kScoreGapTrailing, kScoreGapInner,
   kScoreGapInner, kScoreGapInner, kScoreGapTrailing,
 };
+
+/// Same as foldAscii, for a register of characters.
+template <bool kCaseSensitive, typename T>
+INLINE T foldAsciiSIMD(const T& r) noexcept
+{
+  if constexpr (kCaseSensitive)
+    return r;
+  else
+    return simd::toLower(r);
+}
 } // namespace
 #endif
 
 #if defined(FZX_SSE2)
-// TODO: variable sized needle
+namespace {
 
-template <size_t N>
-Score scoreSSE(const AlignedString& needle, std::string_view haystack) noexcept
+/// c ? a : b
+template <bool kSSE41>
+inline __m128 blendv(const __m128& c, const __m128& a, const __m128& b)
+{
+# if defined(FZX_SSE41)
+  if constexpr (kSSE41)
+    return simd::blendvSSE41(c, a, b);
+# endif
+  return simd::blendv(c, a, b);
+}
+
+/// Shared code of the scoreSSE kernels. Don't call it directly, it's meant
+/// to be flattened into a function targeting the right instruction set.
+template <size_t N, bool kSSE41, bool kCaseSensitive>
+Score scoreSSEImpl(const AlignedString& needle, std::string_view haystack) noexcept
 {
   static_assert(N == 4 || N == 8 || N == 12 || N == 16);
 
   DEBUG_ASSERT(needle.size() <= N);
-  if (needle.empty() || haystack.size() > kMatchMaxLen || needle.size() > haystack.size()) {
+  if (needle.empty() || needle.size() > haystack.size()) {
     return kScoreMin;
   } else if (needle.size() == haystack.size()) {
     return kScoreMax;
@@ -263,7 +608,8 @@ Score scoreSSE(const AlignedString& needle, std::string_view haystack) noexcept
 
   uint32_t lastCh = '/';
   auto g = _mm_set_ss(0); // Leading gap score
-  auto nt = simd::toLower(_mm_load_si128(reinterpret_cast<const __m128i*>(needle.data())));
+  auto nt = foldAsciiSIMD<kCaseSensitive>(
+      _mm_load_si128(reinterpret_cast<const __m128i*>(needle.data())));
 
   if constexpr (N == 4) {
     nt = _mm_unpacklo_epi8(nt, kZero);
@@ -276,7 +622,7 @@ Score scoreSSE(const AlignedString& needle, std::string_view haystack) noexcept
       Score bonus = kBonusStates[kBonusIndex[ch]][lastCh];
       lastCh = ch;
 
-      auto r = _mm_set1_epi32(static_cast<int>(toLower(ch)));
+      auto r = _mm_set1_epi32(static_cast<int>(foldAscii<kCaseSensitive>(ch)));
       auto b = _mm_set1_ps(bonus);
       auto c = _mm_cmpeq_epi32(n, r);
 
@@ -285,7 +631,7 @@ Score scoreSSE(const AlignedString& needle, std::string_view haystack) noexcept
       s = _mm_move_ss(s, _mm_add_ss(g, b));
       g = _mm_add_ss(g, kGapLeading);
 
-      d = simd::blendv(_mm_castsi128_ps(c), s, kMin);
+      d = blendv<kSSE41>(_mm_castsi128_ps(c), s, kMin);
       m = _mm_max_ps(d, _mm_add_ps(m, kGap2));
     }
 
@@ -302,7 +648,7 @@ Score scoreSSE(const AlignedString& needle, std::string_view haystack) noexcept
       Score bonus = kBonusStates[kBonusIndex[ch]][lastCh];
       lastCh = ch;
 
-      auto r = _mm_set1_epi32(static_cast<int>(toLower(ch)));
+      auto r = _mm_set1_epi32(static_cast<int>(foldAscii<kCaseSensitive>(ch)));
       auto b = _mm_set1_ps(bonus);
       auto c1 = _mm_cmpeq_epi32(n1, r);
       auto c2 = _mm_cmpeq_epi32(n2, r);
@@ -315,8 +661,8 @@ Score scoreSSE(const AlignedString& needle, std::string_view haystack) noexcept
       s1 = _mm_move_ss(s1, _mm_add_ss(g, b));
       g = _mm_add_ss(g, kGapLeading);
 
-      d1 = simd::blendv(_mm_castsi128_ps(c1), s1, kMin);
-      d2 = simd::blendv(_mm_castsi128_ps(c2), s2, kMin);
+      d1 = blendv<kSSE41>(_mm_castsi128_ps(c1), s1, kMin);
+      d2 = blendv<kSSE41>(_mm_castsi128_ps(c2), s2, kMin);
       m1 = _mm_max_ps(d1, _mm_add_ps(m1, kGap1));
       m2 = _mm_max_ps(d2, _mm_add_ps(m2, kGap2));
     }
@@ -336,7 +682,7 @@ Score scoreSSE(const AlignedString& needle, std::string_view haystack) noexcept
       Score bonus = kBonusStates[kBonusIndex[ch]][lastCh];
       lastCh = ch;
 
-      auto r = _mm_set1_epi32(static_cast<int>(toLower(ch)));
+      auto r = _mm_set1_epi32(static_cast<int>(foldAscii<kCaseSensitive>(ch)));
       auto b = _mm_set1_ps(bonus);
       auto c1 = _mm_cmpeq_epi32(n1, r);
       auto c2 = _mm_cmpeq_epi32(n2, r);
@@ -353,9 +699,9 @@ Score scoreSSE(const AlignedString& needle, std::string_view haystack) noexcept
       s1 = _mm_move_ss(s1, _mm_add_ss(g, b));
       g = _mm_add_ss(g, kGapLeading);
 
-      d1 = simd::blendv(_mm_castsi128_ps(c1), s1, kMin);
-      d2 = simd::blendv(_mm_castsi128_ps(c2), s2, kMin);
-      d3 = simd::blendv(_mm_castsi128_ps(c3), s3, kMin);
+      d1 = blendv<kSSE41>(_mm_castsi128_ps(c1), s1, kMin);
+      d2 = blendv<kSSE41>(_mm_castsi128_ps(c2), s2, kMin);
+      d3 = blendv<kSSE41>(_mm_castsi128_ps(c3), s3, kMin);
       m1 = _mm_max_ps(d1, _mm_add_ps(m1, kGap1));
       m2 = _mm_max_ps(d2, _mm_add_ps(m2, kGap1));
       m3 = _mm_max_ps(d3, _mm_add_ps(m3, kGap2));
@@ -377,7 +723,7 @@ Score scoreSSE(const AlignedString& needle, std::string_view haystack) noexcept
       Score bonus = kBonusStates[kBonusIndex[ch]][lastCh];
       lastCh = ch;
 
-      auto r = _mm_set1_epi32(static_cast<int>(toLower(ch)));
+      auto r = _mm_set1_epi32(static_cast<int>(foldAscii<kCaseSensitive>(ch)));
       auto b = _mm_set1_ps(bonus);
       auto c1 = _mm_cmpeq_epi32(n1, r);
       auto c2 = _mm_cmpeq_epi32(n2, r);
@@ -398,10 +744,10 @@ Score scoreSSE(const AlignedString& needle, std::string_view haystack) noexcept
       s1 = _mm_move_ss(s1, _mm_add_ss(g, b));
       g = _mm_add_ss(g, kGapLeading);
 
-      d1 = simd::blendv(_mm_castsi128_ps(c1), s1, kMin);
-      d2 = simd::blendv(_mm_castsi128_ps(c2), s2, kMin);
-      d3 = simd::blendv(_mm_castsi128_ps(c3), s3, kMin);
-      d4 = simd::blendv(_mm_castsi128_ps(c4), s4, kMin);
+      d1 = blendv<kSSE41>(_mm_castsi128_ps(c1), s1, kMin);
+      d2 = blendv<kSSE41>(_mm_castsi128_ps(c2), s2, kMin);
+      d3 = blendv<kSSE41>(_mm_castsi128_ps(c3), s3, kMin);
+      d4 = blendv<kSSE41>(_mm_castsi128_ps(c4), s4, kMin);
       m1 = _mm_max_ps(d1, _mm_add_ps(m1, kGap1));
       m2 = _mm_max_ps(d2, _mm_add_ps(m2, kGap1));
       m3 = _mm_max_ps(d3, _mm_add_ps(m3, kGap1));
@@ -412,21 +758,370 @@ Score scoreSSE(const AlignedString& needle, std::string_view haystack) noexcept
   }
 }
 
-template Score scoreSSE<4>(const AlignedString& needle, std::string_view haystack) noexcept;
-template Score scoreSSE<8>(const AlignedString& needle, std::string_view haystack) noexcept;
-template Score scoreSSE<12>(const AlignedString& needle, std::string_view haystack) noexcept;
-template Score scoreSSE<16>(const AlignedString& needle, std::string_view haystack) noexcept;
+/// Shared code of the scoreSSELong kernels. Same as scoreSSEImpl, except the needle
+/// is split across as many registers as it needs, 4 needle characters per register.
+template <bool kSSE41, bool kCaseSensitive>
+Score scoreSSELongImpl(const AlignedString& needle, std::string_view haystack) noexcept
+{
+  if (needle.empty() || needle.size() > kMatchMaxLen || needle.size() > haystack.size()) {
+    return kScoreMin;
+  } else if (needle.size() == haystack.size()) {
+    return kScoreMax;
+  }
+
+  constexpr auto kMaxRegs = kMatchMaxLen / 4;
+  static_assert(isMulOf<4>(kMaxRegs));
+  const int haystackLen = static_cast<int>(haystack.size());
+  const int regs = static_cast<int>((needle.size() + 3) / 4);
+  const int last = regs - 1;
+
+  const auto kZero = _mm_setzero_si128();
+  const auto kMin = _mm_set1_ps(kScoreMin);
+  const auto kGap1 = _mm_set1_ps(kScoreGapInner);
+  const auto kGap2 = _mm_loadu_ps(&kGapTable[3 - (needle.size() & 0b11)]);
+  const auto kConsecutive = _mm_set1_ps(kScoreMatchConsecutive);
+  const auto kGapLeading = _mm_set_ss(kScoreGapLeading);
+
+  // Needle characters, and D and M scores for each of them, see fzx::score.
+  // Needle is padded with zeros to the cache line size, so it can be loaded 16 bytes at a time.
+  __m128i n[kMaxRegs]; // NOLINT(cppcoreguidelines-pro-type-member-init)
+  __m128 d[kMaxRegs]; // NOLINT(cppcoreguidelines-pro-type-member-init)
+  __m128 m[kMaxRegs]; // NOLINT(cppcoreguidelines-pro-type-member-init)
+  const auto* np = reinterpret_cast<const __m128i*>(needle.data());
+  for (int k = 0; k < regs; k += 4) {
+    auto nt = foldAsciiSIMD<kCaseSensitive>(_mm_load_si128(np++));
+    auto nlo = _mm_unpacklo_epi8(nt, kZero);
+    auto nhi = _mm_unpackhi_epi8(nt, kZero);
+    n[k + 0] = _mm_unpacklo_epi16(nlo, kZero);
+    n[k + 1] = _mm_unpackhi_epi16(nlo, kZero);
+    n[k + 2] = _mm_unpacklo_epi16(nhi, kZero);
+    n[k + 3] = _mm_unpackhi_epi16(nhi, kZero);
+  }
+  for (int k = 0; k < regs; ++k) {
+    d[k] = kMin;
+    m[k] = kMin;
+  }
+
+  uint32_t lastCh = '/';
+  auto g = _mm_set_ss(0); // Leading gap score
+
+  for (int i = 0; i < haystackLen; ++i) {
+    uint32_t ch = static_cast<uint8_t>(haystack[i]);
+    Score bonus = kBonusStates[kBonusIndex[ch]][lastCh];
+    lastCh = ch;
+
+    auto r = _mm_set1_epi32(static_cast<int>(foldAscii<kCaseSensitive>(ch)));
+    auto b = _mm_set1_ps(bonus);
+
+    // Score for the first needle character, shifted into the first register.
+    auto carry = _mm_add_ss(g, b);
+    g = _mm_add_ss(g, kGapLeading);
+
+    auto step = [&](int k, const __m128& gap) {
+      auto c = _mm_cmpeq_epi32(n[k], r);
+      auto s = _mm_max_ps(_mm_add_ps(m[k], b), _mm_add_ps(d[k], kConsecutive));
+      s = _mm_shuffle_ps(s, s, _MM_SHUFFLE(2, 1, 0, 3));
+      auto next = s; // The last lane is shifted into the next register
+      s = _mm_move_ss(s, carry);
+      carry = next;
+
+      d[k] = blendv<kSSE41>(_mm_castsi128_ps(c), s, kMin);
+      m[k] = _mm_max_ps(d[k], _mm_add_ps(m[k], gap));
+    };
+
+    for (int k = 0; k < last; ++k)
+      step(k, kGap1);
+    step(last, kGap2);
+  }
+
+  return simd::extractv(m[last], (needle.size() + 3) & 0b11);
+}
+
+template <size_t N, bool kCaseSensitive>
+FLATTEN Score scoreSSE2(const AlignedString& needle, std::string_view haystack) noexcept
+{
+  return scoreSSEImpl<N, false, kCaseSensitive>(needle, haystack);
+}
+
+template <bool kCaseSensitive>
+FLATTEN Score scoreSSELong2(const AlignedString& needle, std::string_view haystack) noexcept
+{
+  return scoreSSELongImpl<false, kCaseSensitive>(needle, haystack);
+}
+
+# if defined(FZX_SSE41)
+template <size_t N, bool kCaseSensitive>
+TARGET("sse4.1") FLATTEN Score scoreSSE41(const AlignedString& needle,
+                                           std::string_view haystack) noexcept
+{
+  return scoreSSEImpl<N, true, kCaseSensitive>(needle, haystack);
+}
+
+template <bool kCaseSensitive>
+TARGET("sse4.1") FLATTEN Score scoreSSELong41(const AlignedString& needle,
+                                               std::string_view haystack) noexcept
+{
+  return scoreSSELongImpl<true, kCaseSensitive>(needle, haystack);
+}
+# endif
+
+using ScoreFn = Score (*)(const AlignedString& needle, std::string_view haystack) noexcept;
+
+template <bool kCaseSensitive>
+std::array<ScoreFn, 4> pickScoreSSEKernels() noexcept
+{
+# if defined(FZX_SSE41)
+  if (cpuSupports(kCpuSSE41)) {
+    return { scoreSSE41<4, kCaseSensitive>, scoreSSE41<8, kCaseSensitive>,
+             scoreSSE41<12, kCaseSensitive>, scoreSSE41<16, kCaseSensitive> };
+  }
+# endif
+  return { scoreSSE2<4, kCaseSensitive>, scoreSSE2<8, kCaseSensitive>,
+           scoreSSE2<12, kCaseSensitive>, scoreSSE2<16, kCaseSensitive> };
+}
+
+template <bool kCaseSensitive>
+ScoreFn pickScoreSSELongKernel() noexcept
+{
+# if defined(FZX_SSE41)
+  if (cpuSupports(kCpuSSE41))
+    return scoreSSELong41<kCaseSensitive>;
+# endif
+  return scoreSSELong2<kCaseSensitive>;
+}
+
+// Kernels for N = 4, 8, 12 and 16, indexed by case sensitivity first. Selected once, when the
+// library is loaded.
+const std::array<ScoreFn, 4> kScoreSSEKernels[2] {
+  pickScoreSSEKernels<false>(),
+  pickScoreSSEKernels<true>(),
+};
+
+const ScoreFn kScoreSSELongKernel[2] {
+  pickScoreSSELongKernel<false>(),
+  pickScoreSSELongKernel<true>(),
+};
+
+} // namespace
+
+template <size_t N, bool kCaseSensitive>
+Score scoreSSE(const AlignedString& needle, std::string_view haystack) noexcept
+{
+  static_assert(N == 4 || N == 8 || N == 12 || N == 16);
+  const auto window = scoreWindow(needle, haystack, kCaseSensitive);
+  return kScoreSSEKernels[kCaseSensitive][N / 4 - 1](needle, window.mStr) + window.mGaps;
+}
+
+template Score scoreSSE<4, false>(const AlignedString& needle, std::string_view haystack) noexcept;
+template Score scoreSSE<8, false>(const AlignedString& needle, std::string_view haystack) noexcept;
+template Score scoreSSE<12, false>(const AlignedString& needle, std::string_view haystack) noexcept;
+template Score scoreSSE<16, false>(const AlignedString& needle, std::string_view haystack) noexcept;
+template Score scoreSSE<4, true>(const AlignedString& needle, std::string_view haystack) noexcept;
+template Score scoreSSE<8, true>(const AlignedString& needle, std::string_view haystack) noexcept;
+template Score scoreSSE<12, true>(const AlignedString& needle, std::string_view haystack) noexcept;
+template Score scoreSSE<16, true>(const AlignedString& needle, std::string_view haystack) noexcept;
+
+template <bool kCaseSensitive>
+Score scoreSSELong(const AlignedString& needle, std::string_view haystack) noexcept
+{
+  const auto window = scoreWindow(needle, haystack, kCaseSensitive);
+  return kScoreSSELongKernel[kCaseSensitive](needle, window.mStr) + window.mGaps;
+}
+
+template Score scoreSSELong<false>(const AlignedString& needle, std::string_view haystack) noexcept;
+template Score scoreSSELong<true>(const AlignedString& needle, std::string_view haystack) noexcept;
+
+namespace {
+
+/// Bonus of each character in `x`, given the previous characters in `prev`, see kBonusStates.
+INLINE __m128i bonusSSE(const __m128i& x, const __m128i& prev) noexcept
+{
+  static_assert(kScoreMatchSlash == 180 && kScoreMatchWord == 160);
+  static_assert(kScoreMatchCapital == 140 && kScoreMatchDot == 120);
+
+  // Check if characters are in [lo, lo + n) range
+  auto range = [](const __m128i& r, char lo, char n) {
+    auto t = _mm_add_epi8(r, _mm_set1_epi8(static_cast<char>(-128 - lo)));
+    return _mm_cmpgt_epi8(_mm_set1_epi8(static_cast<char>(-128 + n)), t);
+  };
+  auto eq = [](const __m128i& r, char ch) { return _mm_cmpeq_epi8(r, _mm_set1_epi8(ch)); };
+  auto val = [](const __m128i& mask, int v) {
+    return _mm_and_si128(mask, _mm_set1_epi8(static_cast<char>(v)));
+  };
+
+  const auto upper = range(x, 'A', 26);
+  const auto word = _mm_or_si128(_mm_or_si128(range(x, 'a', 26), range(x, '0', 10)), upper);
+  const auto sep = _mm_or_si128(_mm_or_si128(eq(prev, '-'), eq(prev, '_')), eq(prev, ' '));
+  const auto capital = _mm_and_si128(upper, range(prev, 'a', 26));
+
+  // Previous character can be only one of these, so the bonuses can be simply combined
+  auto r = val(eq(prev, '/'), 180);
+  r = _mm_or_si128(r, val(sep, 160));
+  r = _mm_or_si128(r, val(eq(prev, '.'), 120));
+  r = _mm_or_si128(r, val(capital, 140));
+  return _mm_and_si128(r, word);
+}
+
+/// Transpose 4 rows of 16 bytes, so that each 4 bytes of the result are one column.
+INLINE void transposeSSE(__m128i* r) noexcept
+{
+  auto t0 = _mm_unpacklo_epi8(r[0], r[1]);
+  auto t1 = _mm_unpackhi_epi8(r[0], r[1]);
+  auto t2 = _mm_unpacklo_epi8(r[2], r[3]);
+  auto t3 = _mm_unpackhi_epi8(r[2], r[3]);
+  r[0] = _mm_unpacklo_epi16(t0, t2);
+  r[1] = _mm_unpackhi_epi16(t0, t2);
+  r[2] = _mm_unpacklo_epi16(t1, t3);
+  r[3] = _mm_unpackhi_epi16(t1, t3);
+}
+
+} // namespace
+
+template <size_t N, bool kCaseSensitive>
+void scoreBatchSSE(const AlignedString& needle,
+                   const std::string_view* haystacks,
+                   Score* scores) noexcept
+{
+  static_assert(N >= 1 && N <= 3);
+  static_assert(kScoreBatch == 4);
+  DEBUG_ASSERT(needle.size() == N);
+
+  // Same algorithm as fzx::score, but each lane runs it on a different haystack. Lanes are
+  // masked out here if there is nothing to calculate, and are fixed up at the end.
+  std::string_view windows[kScoreBatch];
+  alignas(16) Score gaps[kScoreBatch];
+  alignas(16) int32_t lens[kScoreBatch];
+  int maxLen = 0;
+  for (size_t j = 0; j < kScoreBatch; ++j) {
+    const auto window = scoreWindow(needle, haystacks[j], kCaseSensitive);
+    windows[j] = window.mStr;
+    gaps[j] = window.mGaps;
+    const size_t size = windows[j].size();
+    lens[j] = size <= N ? 0 : static_cast<int32_t>(size);
+    maxLen = std::max(maxLen, lens[j]);
+  }
+
+  const auto kZero = _mm_setzero_si128();
+  const auto kMin = _mm_set1_ps(kScoreMin);
+  const auto kGapInner = _mm_set1_ps(kScoreGapInner);
+  const auto kGapTrailing = _mm_set1_ps(kScoreGapTrailing);
+  const auto kGapLeading = _mm_set1_ps(kScoreGapLeading);
+  const auto kConsecutive = _mm_set1_ps(kScoreMatchConsecutive);
+  const auto kOne = _mm_set1_epi32(1);
+
+  __m128i n[N];
+  __m128 d[N];
+  __m128 m[N];
+  for (size_t k = 0; k < N; ++k) {
+    n[k] = _mm_set1_epi8(foldAscii<kCaseSensitive>(needle[k]));
+    d[k] = kMin;
+    m[k] = kMin;
+  }
+
+  const auto lenv = _mm_load_si128(reinterpret_cast<const __m128i*>(lens));
+  auto pos = _mm_set1_epi32(1); // Position + 1, compared with the lengths to find last characters
+  auto g = _mm_setzero_ps(); // Leading gap score
+  auto res = kMin;
+  __m128i carry[kScoreBatch]; // Last character of the previous block
+  for (auto& c : carry)
+    c = _mm_cvtsi32_si128('/');
+
+  for (int base = 0; base < maxLen; base += 16) {
+    // Load the next 16 characters of each haystack. Compare them and calculate bonuses for
+    // all of them at once, and transpose the results so that each haystack is in its own lane.
+    __m128i chars[kScoreBatch];
+    __m128i bonus[kScoreBatch];
+    for (size_t j = 0; j < kScoreBatch; ++j) {
+      auto x = base < lens[j]
+          ? _mm_loadu_si128(reinterpret_cast<const __m128i*>(windows[j].data() + base))
+          : kZero;
+      auto prev = _mm_or_si128(_mm_slli_si128(x, 1), carry[j]);
+      carry[j] = _mm_srli_si128(x, 15);
+      chars[j] = foldAsciiSIMD<kCaseSensitive>(x);
+      bonus[j] = bonusSSE(x, prev);
+    }
+    transposeSSE(chars);
+    transposeSSE(bonus);
+
+    // Widen everything to 32 bits
+    __m128 b[16];
+    __m128 c[N][16];
+    for (size_t q = 0; q < 4; ++q) {
+      auto blo = _mm_unpacklo_epi8(bonus[q], kZero);
+      auto bhi = _mm_unpackhi_epi8(bonus[q], kZero);
+      b[q * 4 + 0] = _mm_cvtepi32_ps(_mm_unpacklo_epi16(blo, kZero));
+      b[q * 4 + 1] = _mm_cvtepi32_ps(_mm_unpackhi_epi16(blo, kZero));
+      b[q * 4 + 2] = _mm_cvtepi32_ps(_mm_unpacklo_epi16(bhi, kZero));
+      b[q * 4 + 3] = _mm_cvtepi32_ps(_mm_unpackhi_epi16(bhi, kZero));
+      for (size_t k = 0; k < N; ++k) {
+        auto mask = _mm_cmpeq_epi8(chars[q], n[k]);
+        auto mlo = _mm_unpacklo_epi8(mask, mask);
+        auto mhi = _mm_unpackhi_epi8(mask, mask);
+        c[k][q * 4 + 0] = _mm_castsi128_ps(_mm_unpacklo_epi16(mlo, mlo));
+        c[k][q * 4 + 1] = _mm_castsi128_ps(_mm_unpackhi_epi16(mlo, mlo));
+        c[k][q * 4 + 2] = _mm_castsi128_ps(_mm_unpacklo_epi16(mhi, mhi));
+        c[k][q * 4 + 3] = _mm_castsi128_ps(_mm_unpackhi_epi16(mhi, mhi));
+      }
+    }
+
+    for (size_t i = 0; i < 16; ++i) {
+      // Go backwards, so the previous row still has the scores from the previous character
+      for (size_t k = N - 1; k > 0; --k) {
+        auto s = _mm_max_ps(_mm_add_ps(m[k - 1], b[i]), _mm_add_ps(d[k - 1], kConsecutive));
+        d[k] = simd::blendv(c[k][i], s, kMin);
+        m[k] = _mm_max_ps(d[k], _mm_add_ps(m[k], k == N - 1 ? kGapTrailing : kGapInner));
+      }
+      d[0] = simd::blendv(c[0][i], _mm_add_ps(g, b[i]), kMin);
+      m[0] = _mm_max_ps(d[0], _mm_add_ps(m[0], N == 1 ? kGapTrailing : kGapInner));
+      g = _mm_add_ps(g, kGapLeading);
+
+      // Save the score of lanes that just reached the end of their haystack
+      res = simd::blendv(_mm_castsi128_ps(_mm_cmpeq_epi32(pos, lenv)), m[N - 1], res);
+      pos = _mm_add_epi32(pos, kOne);
+    }
+  }
+
+  _mm_storeu_ps(scores, _mm_add_ps(res, _mm_load_ps(gaps)));
+  for (size_t j = 0; j < kScoreBatch; ++j) {
+    const size_t size = windows[j].size();
+    if (size < N)
+      scores[j] = kScoreMin;
+    else if (size == N)
+      scores[j] = kScoreMax;
+  }
+}
+
+template void scoreBatchSSE<1, false>(const AlignedString& needle,
+                                      const std::string_view* haystacks,
+                                      Score* scores) noexcept;
+template void scoreBatchSSE<2, false>(const AlignedString& needle,
+                                      const std::string_view* haystacks,
+                                      Score* scores) noexcept;
+template void scoreBatchSSE<3, false>(const AlignedString& needle,
+                                      const std::string_view* haystacks,
+                                      Score* scores) noexcept;
+template void scoreBatchSSE<1, true>(const AlignedString& needle,
+                                     const std::string_view* haystacks,
+                                     Score* scores) noexcept;
+template void scoreBatchSSE<2, true>(const AlignedString& needle,
+                                     const std::string_view* haystacks,
+                                     Score* scores) noexcept;
+template void scoreBatchSSE<3, true>(const AlignedString& needle,
+                                     const std::string_view* haystacks,
+                                     Score* scores) noexcept;
 
 #endif // defined(FZX_SSE2)
 
 #if defined(FZX_NEON)
-template <size_t N>
-Score scoreNeon(const AlignedString& needle, std::string_view haystack) noexcept
+namespace {
+
+template <size_t N, bool kCaseSensitive>
+Score scoreNeonImpl(const AlignedString& needle, std::string_view haystack) noexcept
 {
   static_assert(N == 4 || N == 8 || N == 12 || N == 16);
 
   DEBUG_ASSERT(needle.size() <= N);
-  if (needle.empty() || haystack.size() > kMatchMaxLen || needle.size() > haystack.size()) {
+  if (needle.empty() || needle.size() > haystack.size()) {
     return kScoreMin;
   } else if (needle.size() == haystack.size()) {
     return kScoreMax;
@@ -442,7 +1137,8 @@ Score scoreNeon(const AlignedString& needle, std::string_view haystack) noexcept
 
   uint8_t lastCh = '/';
   float g = 0.f; // Leading gap score
-  auto nt = simd::toLower(vld1q_u8(reinterpret_cast<const uint8_t*>(needle.data())));
+  auto nt = foldAsciiSIMD<kCaseSensitive>(
+      vld1q_u8(reinterpret_cast<const uint8_t*>(needle.data())));
 
   if constexpr (N == 4) {
     auto nl = vmovl_u8(vget_low_u8(nt));
@@ -455,7 +1151,7 @@ Score scoreNeon(const AlignedString& needle, std::string_view haystack) noexcept
       Score bonus = kBonusStates[kBonusIndex[ch]][lastCh];
       lastCh = ch;
 
-      auto r = vmovq_n_u32(toLower(ch));
+      auto r = vmovq_n_u32(foldAscii<kCaseSensitive>(ch));
       auto b = vmovq_n_f32(bonus);
       auto c = vceqq_u32(n, r);
       auto s = vmaxq_f32(vaddq_f32(m, b), vaddq_f32(d, kConsecutive));
@@ -479,7 +1175,7 @@ Score scoreNeon(const AlignedString& needle, std::string_view haystack) noexcept
       Score bonus = kBonusStates[kBonusIndex[ch]][lastCh];
       lastCh = ch;
 
-      auto r = vmovq_n_u32(toLower(ch));
+      auto r = vmovq_n_u32(foldAscii<kCaseSensitive>(ch));
       auto b = vmovq_n_f32(bonus);
       auto c1 = vceqq_u32(n1, r);
       auto c2 = vceqq_u32(n2, r);
@@ -513,7 +1209,7 @@ Score scoreNeon(const AlignedString& needle, std::string_view haystack) noexcept
       Score bonus = kBonusStates[kBonusIndex[ch]][lastCh];
       lastCh = ch;
 
-      auto r = vmovq_n_u32(toLower(ch));
+      auto r = vmovq_n_u32(foldAscii<kCaseSensitive>(ch));
       auto b = vmovq_n_f32(bonus);
       auto c1 = vceqq_u32(n1, r);
       auto c2 = vceqq_u32(n2, r);
@@ -554,7 +1250,7 @@ Score scoreNeon(const AlignedString& needle, std::string_view haystack) noexcept
       Score bonus = kBonusStates[kBonusIndex[ch]][lastCh];
       lastCh = ch;
 
-      auto r = vmovq_n_u32(toLower(ch));
+      auto r = vmovq_n_u32(foldAscii<kCaseSensitive>(ch));
       auto b = vmovq_n_f32(bonus);
       auto c1 = vceqq_u32(n1, r);
       auto c2 = vceqq_u32(n2, r);
@@ -589,16 +1285,32 @@ Score scoreNeon(const AlignedString& needle, std::string_view haystack) noexcept
   }
 }
 
-template Score scoreNeon<4>(const AlignedString& needle, std::string_view haystack) noexcept;
-template Score scoreNeon<8>(const AlignedString& needle, std::string_view haystack) noexcept;
-template Score scoreNeon<12>(const AlignedString& needle, std::string_view haystack) noexcept;
-template Score scoreNeon<16>(const AlignedString& needle, std::string_view haystack) noexcept;
+} // namespace
+
+template <size_t N, bool kCaseSensitive>
+Score scoreNeon(const AlignedString& needle, std::string_view haystack) noexcept
+{
+  const auto window = scoreWindow(needle, haystack, kCaseSensitive);
+  return scoreNeonImpl<N, kCaseSensitive>(needle, window.mStr) + window.mGaps;
+}
+
+template Score scoreNeon<4, false>(const AlignedString& needle, std::string_view haystack) noexcept;
+template Score scoreNeon<8, false>(const AlignedString& needle, std::string_view haystack) noexcept;
+template Score scoreNeon<12, false>(const AlignedString& needle,
+                                    std::string_view haystack) noexcept;
+template Score scoreNeon<16, false>(const AlignedString& needle,
+                                    std::string_view haystack) noexcept;
+template Score scoreNeon<4, true>(const AlignedString& needle, std::string_view haystack) noexcept;
+template Score scoreNeon<8, true>(const AlignedString& needle, std::string_view haystack) noexcept;
+template Score scoreNeon<12, true>(const AlignedString& needle, std::string_view haystack) noexcept;
+template Score scoreNeon<16, true>(const AlignedString& needle, std::string_view haystack) noexcept;
 
 #endif // defined(FZX_NEON)
 
 Score matchPositions(std::string_view needle,
                      std::string_view haystack,
-                     std::vector<bool>* positions)
+                     std::vector<bool>* positions,
+                     bool caseSensitive)
 {
   if (positions) {
     ASSERT(positions->size() == haystack.size());
@@ -607,72 +1319,22 @@ Score matchPositions(std::string_view needle,
   if (needle.empty())
     return kScoreMin;
 
-  MatchStruct match { needle, haystack };
-
-  const int needleLen = match.mNeedleLen;
-  const int haystackLen = match.mHaystackLen;
-
-  if (haystackLen > kMatchMaxLen || needleLen > haystackLen) {
-    // Unreasonably large candidate: return no score
-    // If it is a valid match it will still be returned, it will
-    // just be ranked below any reasonably sized candidates
-    return kScoreMin;
-  } else if (needleLen == haystackLen) {
-    // Since this method can only be called with a haystack which
-    // matches needle. If the lengths of the strings are equal the
-    // strings themselves must also be equal (ignoring case).
-    if (positions)
-      for (auto&& position : *positions)
-        position = true;
-    return kScoreMax;
-  }
-
-  // D[][] Stores the best score for this position ending with a match.
-  // M[][] Stores the best possible score at this position.
-  std::vector<ScoreArray> d;
-  std::vector<ScoreArray> m;
-  d.resize(needleLen);
-  m.resize(needleLen);
-
-  Score* lastD = nullptr;
-  Score* lastM = nullptr;
-  Score* currD = nullptr;
-  Score* currM = nullptr;
-
-  for (int i = 0; i < needleLen; ++i) {
-    currD = d[i].data();
-    currM = m[i].data();
-
-    match.matchRow(i, currD, currM, lastD, lastM);
-
-    lastD = currD;
-    lastM = currM;
-  }
+  return matchPositionsWindow(needle, haystack, positions, caseSensitive);
+}
 
-  // backtrace to find the positions of optimal matching
+Score matchPositionsUnicode(std::u32string_view needle,
+                            std::u32string_view haystack,
+                            std::vector<bool>* positions,
+                            bool caseSensitive)
+{
   if (positions) {
-    bool matchRequired = false;
-    for (int i = needleLen - 1, j = haystackLen - 1; i >= 0; --i) {
-      for (; j >= 0; --j) {
-        // There may be multiple paths which result in
-        // the optimal weight.
-        //
-        // For simplicity, we will pick the first one
-        // we encounter, the latest in the candidate
-        // string.
-        if (d[i][j] != kScoreMin && (matchRequired || d[i][j] == m[i][j])) {
-          // If this score was determined using
-          // kScoreMatchConsecutive, the
-          // previous character MUST be a match
-          matchRequired = i && j && m[i][j] == d[i - 1][j - 1] + kScoreMatchConsecutive;
-          positions->at(j--) = true;
-          break;
-        }
-      }
-    }
+    ASSERT(positions->size() == haystack.size());
   }
 
-  return m[needleLen - 1][haystackLen - 1];
+  if (needle.empty())
+    return kScoreMin;
+
+  return matchPositionsWindow(needle, haystack, positions, caseSensitive);
 }
 
 } // namespace fzx
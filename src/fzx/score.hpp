@@ -29,6 +29,7 @@
 #include <array>
 #include <cstddef>
 #include <limits>
+#include <string>
 #include <string_view>
 #include <vector>
 
@@ -38,13 +39,16 @@ namespace fzx {
 
 using Score = float;
 
+/// Longest needle that can be scored. Also the longest haystack the whole DP table is kept for,
+/// longer ones are scored one character at a time, with memory only for the needle.
 static constexpr auto kMatchMaxLen = 1024;
 
 // Scores have been multiplied by 200 to operate on whole numbers, which simplifies things.
 // Multiply the result score by kScoreMultiplier to get back a more readable value.
 //
-// Be careful with changing the values. The maximum and minimum score value times kMatchMaxLen
-// should fit in [-16777216, 16777216] range. See the comments on fzx::MatchedItem class.
+// Be careful with changing the values. Scores are exact as long as they fit in [-16777216,
+// 16777216] range, which holds for needles of kMatchMaxLen characters in haystacks of a few
+// million characters. See the comments on fzx::MatchedItem class.
 
 static constexpr Score kScoreMultiplier = 0.005;
 
@@ -61,31 +65,111 @@ static constexpr Score kScoreMax = std::numeric_limits<Score>::infinity();
 static constexpr Score kScoreMin = -std::numeric_limits<Score>::infinity();
 
 
+/// ASCII scorers are case insensitive by default, the case sensitive versions compare bytes as
+/// they are and score the same alignment the case sensitive matchers and matchPositions pick.
+template <bool kCaseSensitive = false>
 Score score(const AlignedString& needle, std::string_view haystack) noexcept;
+extern template Score score<false>(const AlignedString& needle, std::string_view haystack) noexcept;
+extern template Score score<true>(const AlignedString& needle, std::string_view haystack) noexcept;
+/// Same as fzx::score, for strings with non-ASCII characters. Both strings are decoded from UTF-8,
+/// see fzx::decodeUtf8, and the needle is also case folded unless `caseSensitive` is set.
+Score scoreUnicode(std::u32string_view needle,
+                   std::u32string_view haystack,
+                   bool caseSensitive = false) noexcept;
+template <bool kCaseSensitive = false>
 Score score1(const AlignedString& needle, std::string_view haystack) noexcept;
+extern template Score score1<false>(const AlignedString& needle,
+                                    std::string_view haystack) noexcept;
+extern template Score score1<true>(const AlignedString& needle, std::string_view haystack) noexcept;
 
 #if defined(FZX_SSE2)
-template <size_t N>
+template <size_t N, bool kCaseSensitive = false>
 Score scoreSSE(const AlignedString& needle, std::string_view haystack) noexcept;
-extern template Score scoreSSE<4>(const AlignedString& needle, std::string_view haystack) noexcept;
-extern template Score scoreSSE<8>(const AlignedString& needle, std::string_view haystack) noexcept;
-extern template Score scoreSSE<12>(const AlignedString& needle, std::string_view haystack) noexcept;
-extern template Score scoreSSE<16>(const AlignedString& needle, std::string_view haystack) noexcept;
+extern template Score scoreSSE<4, false>(const AlignedString& needle,
+                                         std::string_view haystack) noexcept;
+extern template Score scoreSSE<8, false>(const AlignedString& needle,
+                                         std::string_view haystack) noexcept;
+extern template Score scoreSSE<12, false>(const AlignedString& needle,
+                                          std::string_view haystack) noexcept;
+extern template Score scoreSSE<16, false>(const AlignedString& needle,
+                                          std::string_view haystack) noexcept;
+extern template Score scoreSSE<4, true>(const AlignedString& needle,
+                                        std::string_view haystack) noexcept;
+extern template Score scoreSSE<8, true>(const AlignedString& needle,
+                                        std::string_view haystack) noexcept;
+extern template Score scoreSSE<12, true>(const AlignedString& needle,
+                                         std::string_view haystack) noexcept;
+extern template Score scoreSSE<16, true>(const AlignedString& needle,
+                                         std::string_view haystack) noexcept;
+/// Any needle size, meant for needles longer than 16 characters.
+template <bool kCaseSensitive = false>
+Score scoreSSELong(const AlignedString& needle, std::string_view haystack) noexcept;
+extern template Score scoreSSELong<false>(const AlignedString& needle,
+                                          std::string_view haystack) noexcept;
+extern template Score scoreSSELong<true>(const AlignedString& needle,
+                                         std::string_view haystack) noexcept;
+
+/// Number of haystacks scored at once by scoreBatchSSE.
+static constexpr size_t kScoreBatch = 4;
+/// Score kScoreBatch haystacks at once, one per SIMD lane. For needles of N characters, where N is
+/// 1 to 3. With such short needles scoreSSE would leave most of the register unused.
+/// Precondition: at least 16 bytes past the haystacks have to be readable, see kOveralloc.
+template <size_t N, bool kCaseSensitive = false>
+void scoreBatchSSE(const AlignedString& needle,
+                   const std::string_view* haystacks,
+                   Score* scores) noexcept;
+extern template void scoreBatchSSE<1, false>(const AlignedString& needle,
+                                             const std::string_view* haystacks,
+                                             Score* scores) noexcept;
+extern template void scoreBatchSSE<2, false>(const AlignedString& needle,
+                                             const std::string_view* haystacks,
+                                             Score* scores) noexcept;
+extern template void scoreBatchSSE<3, false>(const AlignedString& needle,
+                                             const std::string_view* haystacks,
+                                             Score* scores) noexcept;
+extern template void scoreBatchSSE<1, true>(const AlignedString& needle,
+                                            const std::string_view* haystacks,
+                                            Score* scores) noexcept;
+extern template void scoreBatchSSE<2, true>(const AlignedString& needle,
+                                            const std::string_view* haystacks,
+                                            Score* scores) noexcept;
+extern template void scoreBatchSSE<3, true>(const AlignedString& needle,
+                                            const std::string_view* haystacks,
+                                            Score* scores) noexcept;
 #endif // defined(FZX_SSE2)
 
 #if defined(FZX_NEON)
-template <size_t N>
+template <size_t N, bool kCaseSensitive = false>
 Score scoreNeon(const AlignedString& needle, std::string_view haystack) noexcept;
-extern template Score scoreNeon<4>(const AlignedString& needle, std::string_view haystack) noexcept;
-extern template Score scoreNeon<8>(const AlignedString& needle, std::string_view haystack) noexcept;
-extern template Score scoreNeon<12>(const AlignedString& needle,
-                                    std::string_view haystack) noexcept;
-extern template Score scoreNeon<16>(const AlignedString& needle,
-                                    std::string_view haystack) noexcept;
+extern template Score scoreNeon<4, false>(const AlignedString& needle,
+                                          std::string_view haystack) noexcept;
+extern template Score scoreNeon<8, false>(const AlignedString& needle,
+                                          std::string_view haystack) noexcept;
+extern template Score scoreNeon<12, false>(const AlignedString& needle,
+                                           std::string_view haystack) noexcept;
+extern template Score scoreNeon<16, false>(const AlignedString& needle,
+                                           std::string_view haystack) noexcept;
+extern template Score scoreNeon<4, true>(const AlignedString& needle,
+                                         std::string_view haystack) noexcept;
+extern template Score scoreNeon<8, true>(const AlignedString& needle,
+                                         std::string_view haystack) noexcept;
+extern template Score scoreNeon<12, true>(const AlignedString& needle,
+                                          std::string_view haystack) noexcept;
+extern template Score scoreNeon<16, true>(const AlignedString& needle,
+                                          std::string_view haystack) noexcept;
 #endif // defined(FZX_NEON)
 
+/// Case sensitive positions pick only the characters a case sensitive fzx::matchFuzzy would.
+/// Haystacks longer than kMatchMaxLen get positions only if the part from the first possible to
+/// the last possible matched character fits in kMatchMaxLen, the score is always set.
 Score matchPositions(std::string_view needle,
                      std::string_view haystack,
-                     std::vector<bool>* positions);
+                     std::vector<bool>* positions,
+                     bool caseSensitive = false);
+/// Same as fzx::scoreUnicode, positions are indexes of the decoded characters.
+Score matchPositionsUnicode(std::u32string_view needle,
+                            std::u32string_view haystack,
+                            std::vector<bool>* positions,
+                            bool caseSensitive = false);
 
 } // namespace fzx
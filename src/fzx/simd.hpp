@@ -8,7 +8,7 @@
 #if defined(FZX_SSE41)
 # include <smmintrin.h>
 #endif
-#if defined(FZX_AVX) || defined(FZX_AVX2)
+#if defined(FZX_AVX) || defined(FZX_AVX2) || defined(FZX_AVX512)
 # include <immintrin.h>
 #endif
 #if defined(FZX_NEON)
@@ -19,6 +19,10 @@
 
 #include "fzx/macros.hpp"
 
+// FZX_SSE2 and FZX_NEON are the baseline. With FZX_DISPATCH, the other FZX_<ISA> macros only mean
+// that the kernels for them are built. Such code has to be marked with TARGET, and can run only
+// after checking the CPU with fzx::cpuSupports.
+
 namespace fzx::simd {
 
 #if defined(FZX_SSE2)
@@ -39,13 +43,26 @@ INLINE void store(T* p, const __m128i& r) noexcept
 /// c ? a : b
 [[nodiscard]] INLINE __m128 blendv(const __m128& c, const __m128& a, const __m128& b)
 {
-# if defined(FZX_SSE41)
+# if defined(FZX_SSE41) && !defined(FZX_DISPATCH)
   return _mm_blendv_ps(b, a, c);
 # else
   return _mm_or_ps(_mm_and_ps(a, c), _mm_andnot_ps(c, b));
 # endif
 }
 
+# if defined(FZX_SSE41)
+/// c ? a : b
+///
+/// Not forcibly inlined, so it can be called from generic kernel code, that is later flattened
+/// into a function targeting SSE4.1.
+[[nodiscard]] TARGET("sse4.1") inline __m128 blendvSSE41(const __m128& c,
+                                                         const __m128& a,
+                                                         const __m128& b)
+{
+  return _mm_blendv_ps(b, a, c);
+}
+# endif
+
 [[nodiscard]] INLINE float extractv(const __m128& r, unsigned n)
 {
 # if defined(__GNUC__) || defined(__clang__)
@@ -61,12 +78,12 @@ INLINE void store(T* p, const __m128i& r) noexcept
 
 #if defined(FZX_AVX2)
 template <typename T>
-INLINE void store(T* p, const __m256i& r) noexcept
+TARGET("avx2") INLINE void store(T* p, const __m256i& r) noexcept
 {
   _mm256_storeu_si256(reinterpret_cast<__m256i*>(p), r);
 }
 
-[[nodiscard]] INLINE __m256i toLower(const __m256i& r) noexcept
+[[nodiscard]] TARGET("avx2") INLINE __m256i toLower(const __m256i& r) noexcept
 {
   auto t = _mm256_add_epi8(r, _mm256_set1_epi8(63)); // Offset so that A == SCHAR_MIN
   t = _mm256_cmpgt_epi8(_mm256_set1_epi8(static_cast<char>(-102)), t); // Lower or equal Z
@@ -75,6 +92,15 @@ INLINE void store(T* p, const __m256i& r) noexcept
 }
 #endif // defined(FZX_AVX2)
 
+#if defined(FZX_AVX512)
+[[nodiscard]] TARGET("avx512f,avx512bw") INLINE __m512i toLower(const __m512i& r) noexcept
+{
+  auto t = _mm512_sub_epi8(r, _mm512_set1_epi8('A')); // Offset so that A == 0
+  auto m = _mm512_cmplt_epu8_mask(t, _mm512_set1_epi8(26)); // Lower or equal Z
+  return _mm512_mask_add_epi8(r, m, r, _mm512_set1_epi8(32)); // Apply offset
+}
+#endif // defined(FZX_AVX512)
+
 #if defined(FZX_NEON)
 template <typename T>
 INLINE void store(T* p, const uint8x16_t& r) noexcept
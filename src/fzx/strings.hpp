@@ -2,8 +2,10 @@
 
 #pragma once
 
+#include <array>
 #include <cstddef>
 #include <cstdint>
+#include <string_view>
 
 #include "fzx/config.hpp"
 #include "fzx/macros.hpp"
@@ -23,10 +25,39 @@ template <typename T>
   return ch >= 'A' && ch <= 'Z' ? ch + 32 : ch;
 }
 
+/// Bit of each character in the mask returned by fzx::charMask. Letters are case insensitive.
+/// Letters and digits get a bit each, the rest of ASCII shares the next 27 bits. All bytes of
+/// non-ASCII characters share the last bit, so that it doesn't matter how they are case folded.
+inline constexpr auto kCharMaskBits = [] {
+  std::array<uint8_t, 256> r {};
+  for (int i = 0; i < 256; ++i) {
+    const int ch = toLower(i);
+    if (ch >= 'a' && ch <= 'z')
+      r[i] = static_cast<uint8_t>(ch - 'a');
+    else if (ch >= '0' && ch <= '9')
+      r[i] = static_cast<uint8_t>(26 + ch - '0');
+    else if (ch < 0x80)
+      r[i] = static_cast<uint8_t>(36 + ch % 27);
+    else
+      r[i] = 63;
+  }
+  return r;
+}();
+
+/// Set of the characters in `s`, as a bit mask. If `s` contains all characters of `t`, then
+/// `(charMask(s) & charMask(t)) == charMask(t)`. The opposite isn't necessarily true.
+[[nodiscard]] inline uint64_t charMask(std::string_view s) noexcept
+{
+  uint64_t r = 0;
+  for (char ch : s)
+    r |= uint64_t { 1 } << kCharMaskBits[static_cast<uint8_t>(ch)];
+  return r;
+}
+
 /// `in` is expected to be overallocated with at least fzx::kOveralloc bytes beyond `len`
 inline void toLower(char* RESTRICT out, const char* RESTRICT in, size_t len) noexcept
 {
-#if defined(FZX_AVX2)
+#if defined(FZX_AVX2) && !defined(FZX_DISPATCH)
   static_assert(fzx::kOveralloc >= 32);
   for (size_t i = 0; i < len; i += 32) {
     auto s = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(in + i));
@@ -49,6 +49,7 @@ int main(int argc, char** argv)
 
   // TODO: command line option
   app.mFzx.setThreads(std::thread::hardware_concurrency());
+  app.mFzx.setResultsLimit(1024);
   app.mFzx.setCallback([](void* app) { static_cast<fzx::TermApp*>(app)->mEventFd.notify(); }, &app);
 
   // TODO: handle SIGTERM, SIGQUIT, SIGHUP
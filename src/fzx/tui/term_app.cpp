@@ -79,7 +79,7 @@ void TermApp::processTTY()
         mCursor--;
       }
     } else if (*key == kTab) {
-      if (mCursor < mFzx.resultsSize()) {
+      if (mCursor < mFzx.availableResults()) {
         const uint32_t index = mFzx.getResult(mCursor).mIndex;
         if (mSelection.find(index) != mSelection.end()) {
           mSelection.erase(index);
@@ -115,7 +115,9 @@ void TermApp::redraw()
 
   int maxHeight = mTTY.height() - 2;
   int itemWidth = mTTY.width() - 2;
-  size_t items = mFzx.resultsSize();
+  // Make sure everything up to the cursor and the entire screen will be available.
+  mFzx.reserveResults(mCursor + maxHeight);
+  size_t items = mFzx.availableResults();
   mCursor = std::clamp(mCursor, (size_t)0, items - 1);
 
   std::vector<bool> positions;
@@ -204,7 +206,7 @@ void TermApp::printSelection()
 
 std::string_view TermApp::currentItem() const
 {
-  if (mCursor < mFzx.resultsSize())
+  if (mCursor < mFzx.availableResults())
     return mFzx.getResult(mCursor).mLine;
   return {};
 }
@@ -0,0 +1,164 @@
+// Licensed under LGPLv3 - see LICENSE file for details.
+
+#include "fzx/unicode.hpp"
+
+#include "fzx/strings.hpp"
+#include "fzx/util.hpp"
+
+namespace fzx {
+
+bool isAscii(std::string_view s) noexcept
+{
+  const char* p = s.data();
+  const size_t size = s.size();
+  uint64_t acc = 0;
+  size_t i = 0;
+  for (; i + 8 <= size; i += 8)
+    acc |= load<uint64_t>(p + i);
+  for (; i < size; ++i)
+    acc |= static_cast<uint8_t>(p[i]);
+  return (acc & 0x8080808080808080ULL) == 0;
+}
+
+char32_t decodeUtf8(const char*& it, const char* end) noexcept
+{
+  const auto b0 = static_cast<uint8_t>(*it++);
+  if (b0 < 0x80)
+    return b0;
+
+  const char32_t invalid = 0xDC00 | b0;
+  size_t len = 0;
+  char32_t ch = 0;
+  char32_t min = 0;
+  if ((b0 & 0xE0) == 0xC0) {
+    len = 1;
+    ch = b0 & 0x1F;
+    min = 0x80;
+  } else if ((b0 & 0xF0) == 0xE0) {
+    len = 2;
+    ch = b0 & 0x0F;
+    min = 0x800;
+  } else if ((b0 & 0xF8) == 0xF0) {
+    len = 3;
+    ch = b0 & 0x07;
+    min = 0x10000;
+  } else {
+    return invalid;
+  }
+
+  if (static_cast<size_t>(end - it) < len)
+    return invalid;
+  for (size_t i = 0; i < len; ++i) {
+    const auto b = static_cast<uint8_t>(it[i]);
+    if ((b & 0xC0) != 0x80)
+      return invalid;
+    ch = (ch << 6) | (b & 0x3F);
+  }
+  // Overlong encodings, surrogates and what's past the last code point
+  if (ch < min || ch > 0x10FFFF || (ch >= 0xD800 && ch <= 0xDFFF))
+    return invalid;
+
+  it += len;
+  return ch;
+}
+
+void decodeUtf8(std::string_view s, std::u32string& out, std::vector<uint32_t>* offsets)
+{
+  out.clear();
+  if (offsets != nullptr)
+    offsets->clear();
+  const char* it = s.data();
+  const char* const end = it + s.size();
+  while (it != end) {
+    if (offsets != nullptr)
+      offsets->push_back(static_cast<uint32_t>(it - s.data()));
+    out.push_back(decodeUtf8(it, end));
+  }
+  if (offsets != nullptr)
+    offsets->push_back(static_cast<uint32_t>(s.size()));
+}
+
+char32_t foldCase(char32_t ch) noexcept
+{
+  // Pairs where the uppercase letter is even and the lowercase one follows it
+  auto even = [](char32_t c) -> char32_t { return (c & 1) == 0 ? c + 1 : c; };
+  // Same, but the uppercase letter is odd
+  auto odd = [](char32_t c) -> char32_t { return (c & 1) != 0 ? c + 1 : c; };
+
+  if (ch < 0x80)
+    return toLower(ch);
+
+  // Latin-1 Supplement
+  if (ch < 0x100)
+    return ch >= 0xC0 && ch <= 0xDE && ch != 0xD7 ? ch + 0x20 : ch;
+
+  // Latin Extended-A
+  if (ch < 0x180) {
+    if (ch == 0x130 || ch == 0x138) // İ lowercase is ASCII, ĸ has no uppercase
+      return ch;
+    if (ch == 0x178)
+      return 0xFF;
+    if ((ch >= 0x139 && ch <= 0x148) || (ch >= 0x179 && ch <= 0x17E))
+      return odd(ch);
+    return even(ch);
+  }
+
+  // Greek
+  if (ch >= 0x370 && ch < 0x400) {
+    if (ch >= 0x391 && ch <= 0x3AB && ch != 0x3A2)
+      return ch + 0x20;
+    if (ch == 0x386)
+      return 0x3AC;
+    if (ch >= 0x388 && ch <= 0x38A)
+      return ch + 0x25;
+    if (ch == 0x38C)
+      return 0x3CC;
+    if (ch == 0x38E || ch == 0x38F)
+      return ch + 0x3F;
+    return ch;
+  }
+
+  // Cyrillic
+  if (ch >= 0x400 && ch < 0x530) {
+    if (ch < 0x410)
+      return ch + 0x50;
+    if (ch < 0x430)
+      return ch + 0x20;
+    if ((ch >= 0x460 && ch <= 0x481) || (ch >= 0x48A && ch <= 0x4BF) || ch >= 0x4D0)
+      return even(ch);
+    if (ch == 0x4C0)
+      return 0x4CF;
+    if (ch >= 0x4C1 && ch <= 0x4CE)
+      return odd(ch);
+    return ch;
+  }
+
+  // Latin Extended Additional
+  if (ch >= 0x1E00 && ch < 0x1F00) {
+    if (ch == 0x1E9E)
+      return 0xDF;
+    if (ch <= 0x1E95 || ch >= 0x1EA0)
+      return even(ch);
+    return ch;
+  }
+
+  // Fullwidth Latin
+  if (ch >= 0xFF21 && ch <= 0xFF3A)
+    return ch + 0x20;
+
+  return ch;
+}
+
+bool hasUppercase(std::string_view s) noexcept
+{
+  const char* it = s.data();
+  const char* const end = it + s.size();
+  while (it != end) {
+    const char32_t ch = decodeUtf8(it, end);
+    if (foldCase(ch) != ch)
+      return true;
+  }
+  return false;
+}
+
+} // namespace fzx
@@ -0,0 +1,33 @@
+// Licensed under LGPLv3 - see LICENSE file for details.
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace fzx {
+
+/// Check if `s` has only ASCII characters. Those can use the byte oriented kernels.
+[[nodiscard]] bool isAscii(std::string_view s) noexcept;
+
+/// Decode a UTF-8 character at `it` and move past it. Every byte of an invalid sequence is
+/// decoded separately, as a lone surrogate 0xDC80 - 0xDCFF, which can't match anything valid.
+///
+/// Precondition: it < end
+[[nodiscard]] char32_t decodeUtf8(const char*& it, const char* end) noexcept;
+
+/// Decode UTF-8 string `s` into `out`. Byte offsets of the characters are stored in `offsets`,
+/// if set, with the size of `s` appended at the end.
+void decodeUtf8(std::string_view s, std::u32string& out, std::vector<uint32_t>* offsets = nullptr);
+
+/// Simple lowercase mapping of Latin, Greek, Cyrillic and fullwidth Latin letters. Characters
+/// outside of ASCII are never mapped to ASCII, so ASCII strings can't match non-ASCII needles.
+[[nodiscard]] char32_t foldCase(char32_t ch) noexcept;
+
+/// Check if UTF-8 string `s` has any uppercase letters, ie. letters changed by fzx::foldCase.
+[[nodiscard]] bool hasUppercase(std::string_view s) noexcept;
+
+} // namespace fzx
@@ -3,131 +3,259 @@
 #include "fzx/worker.hpp"
 
 #include <algorithm>
+#include <array>
+#include <chrono>
 #include <cstring>
+#include <string_view>
 
 #include "fzx/config.hpp"
 #include "fzx/fzx.hpp"
 #include "fzx/macros.hpp"
 #include "fzx/score.hpp"
 #include "fzx/match.hpp"
+#include "fzx/numa.hpp"
+#include "fzx/radix_sort.hpp"
 
 namespace fzx {
 
 namespace {
 
-// Results from each worker are merged using this dependency
-// tree, where each vertical lane represents one worker thread:
+// Results from each worker are merged in a single step, by all the workers at once.
 //
-//   0  1  2  3  4  5  6  7  8  9  A  B  C  D  E  F
-//   |  |  |  |  |  |  |  |  |  |  |  |  |  |  |  |
-//   +--+  +--+  +--+  +--+  +--+  +--+  +--+  +--+
-//   |  .  |  .  |  .  |  .  |  .  |  .  |  .  |  .
-//   +-----+  .  +-----+  .  +-----+  .  +-----+  .
-//   |  .  .  .  |  .  .  .  |  .  .  .  |  .  .  .
-//   +-----------+  .  .  .  +-----------+  .  .  .
-//   |  .  .  .  .  .  .  .  |  .  .  .  .  .  .  .
-//   +-----------------------+  .  .  .  .  .  .  .
-//   |  .  .  .  .  .  .  .  .  .  .  .  .  .  .  .
-//
-// At each step the parent worker merges its results with the
-// results from all the workers under it, until the full results
-// end up in the worker 0, that then notifies the main thread.
-
-static_assert(kMaxThreads == 64);
-/// Map of worker index to the parent worker index. The parent is responsible for
-/// merging your results. It has to be notified about results being ready to merge.
-constexpr std::array<uint8_t, kMaxThreads> kParentMap {
-  // clang-format off
-  // 0     1     2     3     4     5     6     7     8     9     A     B     C     D     E     F
-  0x00, 0x00, 0x00, 0x02, 0x00, 0x04, 0x04, 0x06, 0x00, 0x08, 0x08, 0x0A, 0x08, 0x0C, 0x0C, 0x0E,
-  0x00, 0x10, 0x10, 0x12, 0x10, 0x14, 0x14, 0x16, 0x10, 0x18, 0x18, 0x1A, 0x18, 0x1C, 0x1C, 0x1E,
-  0x00, 0x20, 0x20, 0x22, 0x20, 0x24, 0x24, 0x26, 0x20, 0x28, 0x28, 0x2A, 0x28, 0x2C, 0x2C, 0x2E,
-  0x20, 0x30, 0x30, 0x32, 0x30, 0x34, 0x34, 0x36, 0x30, 0x38, 0x38, 0x3A, 0x38, 0x3C, 0x3C, 0x3E,
-  // clang-format on
-};
-
-/// Keep track of results from what workers have been merged in a bitset.
-struct MergeState
+// Every worker adds its sorted results to the Merge of the job. The last one to do so sizes the
+// final results and wakes up the others. The final results are cut into slices, the workers take
+// the slices one by one, and merge the parts of all the results that end up in them directly into
+// the final results, see splitParts. Each item is copied only once, and no worker has to merge
+// everything alone. The worker that merges the last slice notifies the master worker, which
+// publishes the final results.
+
+/// Sorted results of one worker, as a range.
+struct Part
 {
-  MergeState(const uint8_t workerIndex, const size_t workersCount) noexcept : mIndex(workerIndex)
-  {
-    ASSERT(workerIndex < kMaxThreads);
-    ASSERT(workersCount <= kMaxThreads);
-
-    constexpr auto kMaxChildren = 6;
-    // Map of worker index to max possible children count
-    static constexpr std::array<uint8_t, kMaxThreads> kMaxChildrenMap {
-      // clang-format off
-      6, 0, 1, 0, 2, 0, 1, 0, 3, 0, 1, 0, 2, 0, 1, 0,
-      4, 0, 1, 0, 2, 0, 1, 0, 3, 0, 1, 0, 2, 0, 1, 0,
-      5, 0, 1, 0, 2, 0, 1, 0, 3, 0, 1, 0, 2, 0, 1, 0,
-      4, 0, 1, 0, 2, 0, 1, 0, 3, 0, 1, 0, 2, 0, 1, 0,
-      // clang-format on
-    };
-
-    while (mCount < kMaxChildrenMap[workerIndex] && workerIndex + (1U << mCount) < workersCount)
-      ++mCount;
-    ASSERT(mCount <= kMaxChildren);
-
-    mMask = ~(0xFFU << mCount);
-    mState = mMask;
-  }
+  const MatchedItem* mBegin { nullptr };
+  const MatchedItem* mEnd { nullptr };
 
-  // Get children count.
-  [[nodiscard]] uint8_t size() const noexcept { return mCount; }
+  [[nodiscard]] size_t size() const noexcept { return static_cast<size_t>(mEnd - mBegin); }
 
-  [[nodiscard]] uint8_t at(uint8_t child) const noexcept
+  /// Number of items with a key lower than `k`.
+  [[nodiscard]] size_t countBelow(uint64_t k) const noexcept
   {
-    DEBUG_ASSERT(child < mCount);
-    return mIndex + (1U << child);
+    return static_cast<size_t>(std::partition_point(mBegin, mEnd,
+                                                    [k](MatchedItem a) { return a.key() < k; })
+                               - mBegin);
   }
+};
 
-  // Reset state.
-  void reset() noexcept { mState = mMask; }
+using Parts = std::array<Part, kMaxThreads>;
+using Cuts = std::array<size_t, kMaxThreads>;
 
-  // Mark nth child as merged.
-  void set(uint8_t child) noexcept
-  {
-    DEBUG_ASSERT(child < mCount);
-    mState &= ~(1U << child);
+/// Find where the `count` sorted `parts` have to be cut, so that exactly the first `rank` items
+/// of their merged sequence are before the cuts. The number of items before the cut is stored
+/// for each part in `cuts`.
+void splitParts(const Parts& parts, size_t count, size_t rank, Cuts& cuts)
+{
+  size_t total = 0;
+  for (size_t i = 0; i < count; ++i)
+    total += parts[i].size();
+  if (rank == 0 || rank >= total) {
+    for (size_t i = 0; i < count; ++i)
+      cuts[i] = rank == 0 ? 0 : parts[i].size();
+    return;
   }
 
-  // Check if results from all children were merged.
-  [[nodiscard]] bool done() const noexcept { return mState == 0; }
+  // Binary search for the key of the item at `rank`, the lowest key with more than `rank` items
+  // up to it. Keys are unique, as the item indexes are, so exactly `rank` items are below it.
+  uint64_t lo = 0;
+  uint64_t hi = ~uint64_t { 0 };
+  while (lo < hi) {
+    const uint64_t mid = lo + (hi - lo) / 2;
+    size_t upTo = 0;
+    for (size_t i = 0; i < count; ++i)
+      upTo += parts[i].countBelow(mid + 1);
+    if (upTo > rank)
+      hi = mid;
+    else
+      lo = mid + 1;
+  }
+  for (size_t i = 0; i < count; ++i)
+    cuts[i] = parts[i].countBelow(lo);
+}
 
-  // Check if results from nth child were merged.
-  [[nodiscard]] bool contains(uint8_t child) const noexcept
-  {
-    DEBUG_ASSERT(child < mCount);
-    return !(mState & (1U << child));
+/// Merge items [begin, end) of the merged sequence of `parts` into `out`.
+void mergeParts(const Parts& parts, size_t count, size_t begin, size_t end, MatchedItem* out)
+{
+  Cuts first {};
+  Cuts last {};
+  splitParts(parts, count, begin, first);
+  splitParts(parts, count, end, last);
+
+  // Min-heap of the heads of the ranges that are left.
+  std::array<Part, kMaxThreads> heap {};
+  size_t size = 0;
+  for (size_t i = 0; i < count; ++i)
+    if (first[i] < last[i])
+      heap[size++] = { parts[i].mBegin + first[i], parts[i].mBegin + last[i] };
+  auto greater = [](const Part& a, const Part& b) { return *a.mBegin > *b.mBegin; };
+
+  if (size == 1) {
+    std::copy(heap[0].mBegin, heap[0].mEnd, out);
+    return;
+  }
+  if (size == 2) {
+    std::merge(heap[0].mBegin, heap[0].mEnd, heap[1].mBegin, heap[1].mEnd, out);
+    return;
+  }
+  std::make_heap(heap.begin(), heap.begin() + size, greater);
+  while (size > 0) {
+    std::pop_heap(heap.begin(), heap.begin() + size, greater);
+    Part& min = heap[size - 1];
+    *out++ = *min.mBegin++;
+    if (min.mBegin == min.mEnd)
+      --size;
+    else
+      std::push_heap(heap.begin(), heap.begin() + size, greater);
   }
+}
 
-private:
-  uint8_t mIndex { 0 }; ///< Current worker index
-  uint8_t mCount { 0 }; ///< Children count
-  uint8_t mMask { 0 }; ///< Children mask
-  uint8_t mState { 0 }; ///< Merge state
-};
+/// Size the final results once all `workers` added their results, see Merge.
+void startMerge(Merge& merge, size_t workers, size_t limit)
+{
+  size_t size = 0;
+  for (size_t i = 0; i < workers; ++i)
+    size += merge.mParts[i] ? merge.mParts[i]->size() : 0;
+  if (limit != 0)
+    size = std::min(size, limit);
+  merge.mItems.resize(size);
+  // Slices of about a chunk, so small results aren't worth waking up the other workers.
+  merge.mSlices = std::clamp<size_t>(size / kChunkSize, 1, workers);
+  merge.mStarted.store(true, std::memory_order_release);
+}
+
+/// Merge slices of the final results, until there are none left. Returns true if the last
+/// slice was merged by this call.
+///
+/// The final results can be taken by the master worker as soon as all the slices are merged,
+/// so they are accessed only after a slice was claimed.
+bool mergeSlices(Merge& merge, size_t workers)
+{
+  const size_t slices = merge.mSlices;
+  size_t slice = merge.mNextSlice.fetch_add(1, std::memory_order_relaxed);
+  if (slice >= slices)
+    return false;
+
+  Parts parts {};
+  for (size_t i = 0; i < workers; ++i)
+    if (const auto& part = merge.mParts[i]; part)
+      parts[i] = { part->data(), part->data() + part->size() };
+
+  const size_t size = merge.mItems.size();
+  bool last = false;
+  for (; slice < slices; slice = merge.mNextSlice.fetch_add(1, std::memory_order_relaxed)) {
+    const size_t begin = size * slice / slices;
+    const size_t end = size * (slice + 1) / slices;
+    mergeParts(parts, workers, begin, end, merge.mItems.data() + begin);
+    last = merge.mDone.fetch_add(1, std::memory_order_acq_rel) + 1 == slices;
+  }
+  return last;
+}
 
 /// Merge results from sorted vectors `a` and `b` into the output vector `r`.
 /// `r` is an in/out parameter to reuse previously allocated memory.
+/// Only the first `limit` results are kept, unless `limit` is 0.
 void merge2(std::vector<MatchedItem>& RESTRICT r,
             const std::vector<MatchedItem>& RESTRICT a,
-            const std::vector<MatchedItem>& RESTRICT b)
+            const std::vector<MatchedItem>& RESTRICT b,
+            size_t limit)
 {
-  r.resize(a.size() + b.size());
+  size_t size = a.size() + b.size();
+  if (limit != 0)
+    size = std::min(size, limit);
+  r.resize(size);
   const auto ae = a.end();
   const auto be = b.end();
+  const auto re = r.end();
   auto ai = a.begin();
   auto bi = b.begin();
   auto ri = r.begin();
-  while (ai != ae && bi != be)
+  while (ri != re && ai != ae && bi != be)
     *ri++ = *ai < *bi ? *ai++ : *bi++;
-  while (ai != ae)
+  while (ri != re && ai != ae)
     *ri++ = *ai++;
-  while (bi != be)
+  while (ri != re && bi != be)
     *ri++ = *bi++;
-  DEBUG_ASSERT(ri == r.end());
+}
+
+/// Matched items waiting to be scored. Scoring them in batches
+/// allows the query to score multiple items in parallel.
+struct ScoreBatch
+{
+  static constexpr size_t kSize = 16;
+
+  /// Add an item. Returns true if the batch is full and has to be flushed.
+  bool push(uint32_t index, std::string_view item) noexcept
+  {
+    DEBUG_ASSERT(mSize < kSize);
+    mIndexes[mSize] = index;
+    mItems[mSize] = item;
+    return ++mSize == kSize;
+  }
+
+  /// Score the items and append them to `out`.
+  void flush(const Query& query, std::vector<MatchedItem>& out)
+  {
+    query.score(mItems.data(), mScores.data(), mSize);
+    for (size_t i = 0; i < mSize; ++i)
+      out.emplace_back(mIndexes[i], mScores[i]);
+    mSize = 0;
+  }
+
+  /// Drop the items without scoring them.
+  void clear() noexcept { mSize = 0; }
+
+private:
+  std::array<std::string_view, kSize> mItems;
+  std::array<uint32_t, kSize> mIndexes {};
+  std::array<Score, kSize> mScores {};
+  size_t mSize { 0 };
+};
+
+/// Number of items to take from the queue at once. Adapted to the measured cost of the items,
+/// so that a chunk takes about kChunkTimeNs, no matter how long the items are or how expensive
+/// the query is.
+struct ChunkSize
+{
+  using Clock = std::chrono::steady_clock;
+
+  [[nodiscard]] size_t get() const noexcept { return mSize; }
+
+  /// Start measuring a chunk.
+  void start() noexcept { mStart = Clock::now(); }
+
+  /// Adapt the size to how long it took to process `count` items since start.
+  void update(size_t count) noexcept
+  {
+    const auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - mStart);
+    if (count == 0 || ns.count() <= 0)
+      return;
+    const double target = static_cast<double>(count) * kChunkTimeNs
+                        / static_cast<double>(ns.count());
+    // Average with the previous size, a single chunk can be an outlier.
+    const double size = (static_cast<double>(mSize) + target) / 2;
+    mSize = static_cast<size_t>(std::clamp<double>(size, kMinChunkSize, kChunkSize));
+  }
+
+private:
+  size_t mSize { kChunkSize };
+  Clock::time_point mStart {};
+};
+
+/// Keep only the best `limit` items in an unsorted vector, unless `limit` is 0.
+void truncate(std::vector<MatchedItem>& items, size_t limit)
+{
+  if (limit == 0 || items.size() <= limit)
+    return;
+  std::nth_element(items.begin(), items.begin() + static_cast<ptrdiff_t>(limit), items.end());
+  items.resize(limit);
 }
 
 } // namespace
@@ -135,8 +263,11 @@ void merge2(std::vector<MatchedItem>& RESTRICT r,
 // TODO: compile time option to disable try/catch
 void Worker::run()
 try {
-  ASSERT(mIndex < mPool->mWorkers.size());
-  ASSERT(mPool->mWorkers.size() <= kMaxThreads);
+  ASSERT(mIndex < kMaxThreads);
+
+  // Pin the thread first, so that everything it allocates ends up on its node.
+  if (mNumaNode >= 0)
+    pinThread(static_cast<size_t>(mNumaNode));
 
   auto& output = mPool->mWorkers[mIndex]->mOutput;
   auto& events = mPool->mWorkers[mIndex]->mEvents;
@@ -145,27 +276,40 @@ try {
   size_t lastItemsTick = 0;
   size_t lastQueryTick = 0;
 
-  // Temporary vector for merging results
-  std::vector<MatchedItem> tmp;
-
-  const uint8_t kParentIndex = kParentMap[mIndex];
-  MergeState mergeState { mIndex, mPool->mWorkers.size() };
+  // Matched items waiting to be scored
+  ScoreBatch batch;
+  // Items taken from the queue at once. Kept across jobs, the next query usually costs about
+  // the same per item.
+  ChunkSize chunkSize;
+
+  // Sorted results of this worker alone. As long as the query doesn't change, they stay
+  // valid when new items are appended, so only the new items have to be processed. They are
+  // never modified, other workers can still be reading them while merging the results.
+  std::shared_ptr<const std::vector<MatchedItem>> local;
+  // Unsorted results from the items processed since the last sort.
+  std::vector<MatchedItem> delta;
+  // Scratch space for sorting delta.
+  std::vector<MatchedItem> sortTmp;
+  // Number of all items matched by this worker, including the ones that didn't fit the limit.
+  size_t localMatched = 0;
+  // Query timestamp of the local results.
+  size_t localQueryTick = 0;
 
   bool published = false;
-  // Commit results and notify whoever is responsible for handling them.
+  // Commit results and notify the external event loop. Only worker 0, the master worker thread,
+  // publishes results.
   auto publish = [&] {
+    DEBUG_ASSERT(mIndex == 0);
     if (published)
       return;
     published = true;
     output.commit();
+    mPool->mCallback(mPool->mUserData);
+  };
 
-    if (mIndex == 0) {
-      // Worker 0 is the master worker thread. Notify the external event loop.
-      mPool->mCallback(mPool->mUserData);
-    } else {
-      // For all other workers, notify the worker that is responsible for merging our results.
-      mPool->mWorkers[kParentIndex]->mEvents.post(kMerge);
-    }
+  // Check if the job's query was replaced, without waiting for the job event.
+  auto stale = [&] {
+    return mPool->mQueryTick.load(std::memory_order_acquire) != job.mQueryTick;
   };
 
   auto loadJob = [&] {
@@ -195,103 +339,186 @@ wait:
   match:
     // A new job invalidates any merged results we got so far.
     published = false;
-    mergeState.reset();
 
-    // Prepare results. Start from scratch with a new item vector and "timestamp" the results.
-    auto& out = output.writeBuffer();
-    out.mItemsTick = job.mItems.size();
-    out.mQueryTick = job.mQueryTick;
-    out.mQuery = job.mQuery;
-    out.mItems.clear();
+    // Only new items were appended if the query didn't change. The results
+    // we got so far can be kept, otherwise start from scratch.
+    if (localQueryTick != job.mQueryTick) {
+      localQueryTick = job.mQueryTick;
+      local.reset();
+      delta.clear();
+      localMatched = 0;
+      // The queue starts after the items covered by the cached results, so the master worker
+      // takes them as its own. The other workers only process what was appended since.
+      if (job.mCached && mIndex == 0) {
+        const auto& cached = *job.mCached;
+        if (job.mLimit == 0 || cached.size() <= job.mLimit) {
+          local = job.mCached;
+        } else {
+          local = std::make_shared<const std::vector<MatchedItem>>(
+              cached.begin(), cached.begin() + static_cast<ptrdiff_t>(job.mLimit));
+        }
+        localMatched = job.mCachedMatched;
+      }
+    }
+
+    // Not needed for this job, park until some other job needs us. The master worker is always
+    // needed. Nothing is kept meanwhile, the next job we get has a different query tick anyway.
+    if (mIndex >= job.mWorkers) {
+      delta = {};
+      sortTmp = {};
+      goto wait;
+    }
+    const size_t workers = job.mWorkers;
+
+    // Prepare results, "timestamp" them. The items are set once they are merged.
+    if (mIndex == 0) {
+      auto& out = output.writeBuffer();
+      out.mItemsTick = job.mItems.size();
+      out.mQueryTick = job.mQueryTick;
+      out.mQuery = job.mQuery;
+      out.mLimit = job.mLimit;
+      out.mMatched = 0;
+    }
 
     // If there is no active query, publish empty results.
     if (!job.mQuery || job.mQuery->empty()) {
-      publish();
+      if (mIndex == 0)
+        publish();
       goto wait;
     }
 
     ASSERT(job.mQueue);
     auto& queue = *job.mQueue;
     const auto& query = *job.mQuery;
-    out.mItems.reserve(job.mItems.size());
+    // Queue indexes the candidates first, followed by all items appended after them.
+    const auto* candidates = job.mCandidates.get();
+    const size_t candidatesSize = candidates ? candidates->size() : 0;
+    const size_t itemsBase = job.mCandidatesTick;
+    const size_t total = candidatesSize + job.mItems.size() - itemsBase;
+    const size_t limit = job.mLimit;
+    // Items of the node the worker is pinned to are processed first, see ItemQueue::shard.
+    const size_t node = mNumaNode >= 0 ? static_cast<size_t>(mNumaNode) : 0;
+    // With a limit, delta is truncated every time it grows to twice the limit.
+    delta.reserve(limit != 0 ? std::min(total, limit * 2 + kChunkSize) : total);
     for (;;) {
       // Reserve a chunk of items.
       //
       // We're not splitting the work evenly upfront, because some threads can have higher
-      // workloads and take more time in total to process all items. The easiest way to work
-      // around this problem is to just get items in fixed sized chunks in a loop. We're paying
-      // with L1 cache misses here, but in the end it's insignificant compared to the disaster
-      // that calculating the score is, so it's still an overall improvement for some cases.
+      // workloads and take more time in total to process all items. Each worker takes chunks
+      // from its own range of items instead, and when it runs out, it claims a new range or
+      // steals a part of the range of a busier worker, see ItemQueue.
       //
-      // Right now reserve is an atomic fetch-add, that can set the shared counter to an out of
-      // bounds value. This is fine for the time being, but if we want to reuse already calculated
-      // items, it will have to be changed to a CAS loop, to guarantee we were within the previous
-      // boundaries when new items are appended.
-      const size_t start = std::min(queue.take(kChunkSize), job.mItems.size());
-      const size_t end = std::min(start + kChunkSize, job.mItems.size());
+      // Reserving never goes past the items we know about, so when new items are appended
+      // to the same job, the queue can continue from where it stopped.
+      //
+      // Chunks are sized by how long the items took so far, so that new jobs are noticed in
+      // time, see ChunkSize. A new query is also checked for every kPreemptInterval items.
+      const auto [start, end] = queue.take(mIndex, chunkSize.get(), total, node);
       if (start >= end)
         break;
+      chunkSize.start();
 
       // Match items and calculate scores.
-      for (size_t i = start; i < end; ++i) {
-        auto item = job.mItems.at(i);
-        if (query.match(item))
-          out.mItems.emplace_back(static_cast<uint32_t>(i), query.score(item));
+      const size_t deltaSize = delta.size();
+      size_t i = start;
+      // Query got narrower, filter only what was matched by the previous query.
+      for (const size_t cend = std::min(end, candidatesSize); i < cend; ++i) {
+        if (i % kPreemptInterval == 0 && stale())
+          goto preempt;
+        const uint32_t index = (*candidates)[i].index();
+        if (!query.mayMatch(job.mItems.charMask(index)))
+          continue;
+        auto item = job.mItems.at(index);
+        if (!job.mItems.isAscii(index)) {
+          Score score = 0;
+          if (query.matchScore(item, false, score))
+            delta.emplace_back(index, score);
+        } else if (query.match(item, true) && batch.push(index, item)) {
+          batch.flush(query, delta);
+        }
       }
-
-      // Ignore kMerge events from other workers, we don't care about
-      // them at this stage, as we don't even have out own results yet.
+      for (; i < end; ++i) {
+        if (i % kPreemptInterval == 0 && stale())
+          goto preempt;
+        const size_t index = i - candidatesSize + itemsBase;
+        if (!query.mayMatch(job.mItems.charMask(index)))
+          continue;
+        auto item = job.mItems.at(index);
+        if (!job.mItems.isAscii(index)) {
+          Score score = 0;
+          if (query.matchScore(item, false, score))
+            delta.emplace_back(static_cast<uint32_t>(index), score);
+        } else if (query.match(item, true) && batch.push(static_cast<uint32_t>(index), item)) {
+          batch.flush(query, delta);
+        }
+      }
+      batch.flush(query, delta);
+      chunkSize.update(end - start);
+      localMatched += delta.size() - deltaSize;
+      // Only the best results can make it to the final results, so drop everything else
+      // early. Truncating only once in a while keeps the amortized cost linear.
+      if (limit != 0 && delta.size() >= limit * 2)
+        truncate(delta, limit);
+
+      // Ignore kMerge events from other workers, they are from some older job, as the merge
+      // can't start without our own results.
       ev = events.get();
       if (ev & kStop)
         return;
       if ((ev & kJob) && loadJob())
         goto match;
+      continue;
+
+    preempt:
+      // The query changed while processing the chunk. The rest of the chunk is dropped along
+      // with the results, the new job is already published.
+      batch.clear();
+      loadJob();
+      goto match;
     }
 
-    // Sort the local batch of items.
-    std::sort(out.mItems.begin(), out.mItems.end());
+    // Sort the new batch of items and merge it with the previous results. The merged results
+    // go into a new vector, the previous one can still be read by the other workers.
+    truncate(delta, limit);
+    radixSort(delta, sortTmp);
+    if (!local || local->empty()) {
+      local = std::make_shared<const std::vector<MatchedItem>>(std::move(delta));
+    } else if (!delta.empty()) {
+      auto merged = std::make_shared<std::vector<MatchedItem>>();
+      merge2(*merged, *local, delta, limit);
+      local = std::move(merged);
+    }
+    delta.clear();
+
+    // Add our results to the final merge. The last worker to do so starts it.
+    Merge& merge = *job.mMerge;
+    merge.mParts[mIndex] = local;
+    merge.mMatched[mIndex] = localMatched;
+    if (merge.mReady.fetch_add(1, std::memory_order_acq_rel) + 1 == workers) {
+      startMerge(merge, workers, limit);
+      if (merge.mSlices > 1)
+        for (size_t i = 0; i < workers; ++i)
+          if (i != mIndex)
+            mPool->mWorkers[i]->mEvents.post(kMerge);
+    }
   }
 
-  // Merge results from other threads.
-  if (!mergeState.done()) {
-    auto& out = output.writeBuffer();
-    for (uint8_t i = 0; i < mergeState.size(); ++i) {
-      // Already got results from this worker, try the next one.
-      if (mergeState.contains(i))
-        continue;
-
-      // Load the results from this worker.
-      const uint8_t id = mergeState.at(i);
-      mPool->mWorkers[id]->mOutput.load();
-      const auto& cres = mPool->mWorkers[id]->mOutput.readBuffer();
-
-      // We've received results with a newer timestamp than ours, so that has to mean
-      // there is a new job that we weren't aware about. Properly wait for new events
-      // and process all of them, just in case.
-      if (cres.newerThan(out))
-        goto wait;
-
-      // No agreement on the timestamp, these results are from some older job, and we
-      // don't want to merge unrelated results. Skip this worker for now.
-      if (!cres.sameTick(out))
-        continue;
-
-      // We agree on the timestamp, results from the child can be merged with our own.
-      if (!cres.mItems.empty()) { // Avoid unnecessary copies
-        merge2(tmp, out.mItems, cres.mItems); // TODO: merge in place?
-        swap(tmp, out.mItems);
-      }
-
-      mergeState.set(i); // Mark this worker as merged.
+  // Help with the final merge, once all the results are in.
+  if (job.mMerge && job.mMerge->mStarted.load(std::memory_order_acquire)) {
+    Merge& merge = *job.mMerge;
+    if (mergeSlices(merge, job.mWorkers) && mIndex != 0)
+      mPool->mWorkers[0]->mEvents.post(kMerge);
+
+    // Publish the final results.
+    if (mIndex == 0 && !published
+        && merge.mDone.load(std::memory_order_acquire) == merge.mSlices) {
+      auto& out = output.writeBuffer();
+      out.mItems = std::make_shared<const std::vector<MatchedItem>>(std::move(merge.mItems));
+      for (size_t i = 0; i < job.mWorkers; ++i)
+        out.mMatched += merge.mMatched[i];
+      publish();
     }
-
-    // Not all results have been merged yet, we're still waiting for someone.
-    if (!mergeState.done())
-      goto wait;
   }
-
-  // Publish results.
-  publish();
   goto wait;
 } catch (const std::exception& e) {
   std::strncpy(mErrorMsg, e.what(), std::size(mErrorMsg));
@@ -2,6 +2,8 @@
 
 #pragma once
 
+#include <array>
+#include <atomic>
 #include <cstddef>
 #include <cstdint>
 #include <memory>
@@ -10,6 +12,7 @@
 #include <vector>
 
 #include "fzx/aligned_string.hpp"
+#include "fzx/config.hpp"
 #include "fzx/events.hpp"
 #include "fzx/matched_item.hpp"
 #include "fzx/query.hpp"
@@ -21,27 +24,46 @@ struct Fzx;
 
 struct Results
 {
-  /// Matched items.
-  std::vector<MatchedItem> mItems;
+  /// Matched items. Never modified once published, so a narrower query can take them as its
+  /// candidates without copying them.
+  std::shared_ptr<const std::vector<MatchedItem>> mItems {
+    std::make_shared<const std::vector<MatchedItem>>()
+  };
   /// Original query.
   /// By the time the results are sent back, the active query could've changed, so
   /// it's necessary to pass it back to make sure matched positions are calculated
   /// using the correct query.
   std::shared_ptr<Query> mQuery;
+  /// Number of matched items. Larger than the size of mItems if the results were truncated.
+  size_t mMatched { 0 };
+  /// Max number of results kept in mItems, 0 if unlimited.
+  size_t mLimit { 0 };
   /// Timestamp identifying items. Last known items size.
   size_t mItemsTick { 0 };
   /// Timestamp identifying the query.
   size_t mQueryTick { 0 };
+};
 
-  [[nodiscard]] bool newerThan(const Results& b) const noexcept
-  {
-    return mItemsTick > b.mItemsTick || mQueryTick > b.mQueryTick;
-  }
-
-  [[nodiscard]] bool sameTick(const Results& b) const noexcept
-  {
-    return mItemsTick == b.mItemsTick && mQueryTick == b.mQueryTick;
-  }
+/// Final merge of the results of one job, shared by all the workers.
+struct Merge
+{
+  /// Sorted results of each worker. Shared, so that a worker can go on with appended items while
+  /// the others are still merging them.
+  std::array<std::shared_ptr<const std::vector<MatchedItem>>, kMaxThreads> mParts {};
+  /// Number of all items matched by each worker, including the ones that didn't fit the limit.
+  std::array<size_t, kMaxThreads> mMatched {};
+  /// Merged results. Sized before mStarted is set, each slice is written by one worker.
+  std::vector<MatchedItem> mItems;
+  /// Number of slices the results are merged in.
+  size_t mSlices { 0 };
+  /// Number of workers that added their results.
+  std::atomic<size_t> mReady { 0 };
+  /// Set once all the workers added their results.
+  std::atomic<bool> mStarted { false };
+  /// Next slice to merge.
+  std::atomic<size_t> mNextSlice { 0 };
+  /// Number of merged slices.
+  std::atomic<size_t> mDone { 0 };
 };
 
 struct Worker
@@ -54,10 +76,13 @@ struct Worker
   };
 
   std::thread mThread;
+  /// Final results, only published by the master worker.
   Tx<Results> mOutput;
   Events mEvents;
   Fzx* mPool { nullptr };
   uint8_t mIndex { 0 };
+  /// NUMA node to pin the thread to, -1 if not pinned.
+  int mNumaNode { -1 };
 
   char mErrorMsg[256] {}; ///< Populated before mError becomes true.
   std::atomic<bool> mError { false }; ///< A critical error has occurred.
@@ -0,0 +1,33 @@
+#include <catch2/catch_test_macros.hpp>
+
+#include "fzx/cpu.hpp"
+
+using namespace fzx;
+
+TEST_CASE("fzx::cpuFeatures")
+{
+  const uint32_t features = cpuFeatures();
+  CHECK(features == cpuFeatures());
+
+  // Only the features that the kernels were built for can be used
+#if !defined(FZX_SSE2)
+  CHECK(!(features & kCpuSSE2));
+#else
+  CHECK(cpuSupports(kCpuSSE2)); // baseline
+#endif
+#if !defined(FZX_SSE41)
+  CHECK(!(features & kCpuSSE41));
+#endif
+#if !defined(FZX_AVX2)
+  CHECK(!(features & kCpuAVX2));
+#endif
+#if !defined(FZX_AVX512)
+  CHECK(!(features & kCpuAVX512));
+#endif
+#if !defined(FZX_NEON)
+  CHECK(!(features & kCpuNEON));
+#endif
+
+  CHECK(cpuSupports(0));
+  CHECK(cpuSupports(features));
+}
@@ -1,12 +1,21 @@
 #include <catch2/catch_test_macros.hpp>
 
+#include <algorithm>
 #include <chrono>
 #include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <filesystem>
 #include <iostream>
 #include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
 
 #include "fzx/fzx.hpp"
 #include "fzx/macros.hpp"
+#include "fzx/matched_item.hpp"
+#include "fzx/query.hpp"
 
 namespace chrono = std::chrono;
 using namespace std::chrono_literals;
@@ -38,6 +47,50 @@ struct Notify
   }
 };
 
+/// Deterministic list of path-like strings.
+std::vector<std::string> makeItems(size_t count)
+{
+  constexpr std::string_view kWords[] {
+    "src", "fzx", "lua", "test", "match", "score", "query", "worker", "items", "Foo", "BAR",
+  };
+  uint32_t state = 12345;
+  auto next = [&] {
+    state = state * 1103515245U + 12345U;
+    return (state >> 16) & 0x7FFF;
+  };
+  std::vector<std::string> r;
+  r.reserve(count);
+  for (size_t i = 0; i < count; ++i) {
+    std::string s;
+    const auto parts = 1 + next() % 4;
+    for (unsigned j = 0; j < parts; ++j) {
+      if (j > 0)
+        s += next() % 3 == 0 ? '_' : '/';
+      s += kWords[next() % std::size(kWords)];
+    }
+    r.push_back(std::move(s));
+  }
+  return r;
+}
+
+/// Match items in a single thread, for comparing the results.
+std::vector<uint32_t> expected(const std::vector<std::string>& items, std::string_view query)
+{
+  const auto q = fzx::Query::parse(query);
+  std::vector<fzx::MatchedItem> matched;
+  for (size_t i = 0; i < items.size(); ++i) {
+    fzx::AlignedString s { items[i] };
+    if (q.match(s.str()))
+      matched.emplace_back(static_cast<uint32_t>(i), q.score(s.str()));
+  }
+  std::sort(matched.begin(), matched.end());
+  std::vector<uint32_t> r;
+  r.reserve(matched.size());
+  for (const auto& m : matched)
+    r.push_back(m.index());
+  return r;
+}
+
 } // namespace
 
 TEST_CASE("fzx::Fzx")
@@ -80,4 +133,324 @@ TEST_CASE("fzx::Fzx")
 
     f.stop();
   }
+
+  auto sync = [&] {
+    while (f.processing()) {
+      REQUIRE(notify.wait(1s));
+      f.loadResults();
+    }
+  };
+
+  auto results = [&] {
+    std::vector<uint32_t> r;
+    r.reserve(f.availableResults());
+    for (size_t i = 0; i < f.availableResults(); ++i)
+      r.push_back(f.getResult(i).mIndex);
+    return r;
+  };
+
+  SECTION("narrowing the query") {
+    f.setThreads(4);
+    f.start();
+
+    const auto items = makeItems(40000);
+    for (const auto& item : items)
+      f.pushItem(item);
+    f.commit();
+
+    for (auto query : { "s"sv, "sr"sv, "src"sv, "src f"sv, "src fo"sv, "src fo !bar"sv }) {
+      CAPTURE(query);
+      f.setQuery(query);
+      sync();
+      CHECK(results() == expected(items, query));
+    }
+
+    f.stop();
+  }
+
+  SECTION("changing the query before the results arrive") {
+    f.setThreads(4);
+    f.start();
+
+    const auto items = makeItems(100000);
+    for (const auto& item : items)
+      f.pushItem(item);
+    f.commit();
+
+    // Every query is replaced while the workers are still processing it.
+    for (auto query : { "s"sv, "sr"sv, "s"sv, "w"sv, "wo"sv, "wor"sv, "work"sv, "lua"sv }) {
+      f.setQuery(query);
+      std::this_thread::sleep_for(1ms);
+    }
+    sync();
+    CHECK(results() == expected(items, "lua"sv));
+
+    f.stop();
+  }
+
+  SECTION("merging many results across many workers") {
+    f.setThreads(8);
+    f.start();
+
+    auto items = makeItems(200000);
+    for (const auto& item : items)
+      f.pushItem(item);
+    f.commit();
+
+    // Broad enough for the final merge to be split into slices.
+    for (auto query : { "s"sv, "r"sv, "st"sv }) {
+      CAPTURE(query);
+      f.setQuery(query);
+      sync();
+      CHECK(results() == expected(items, query));
+    }
+
+    const auto more = makeItems(50000);
+    for (size_t i = 0; i < more.size(); ++i) {
+      f.pushItem(more[i]);
+      if (i % 9973 == 0)
+        f.commit();
+    }
+    items.insert(items.end(), more.begin(), more.end());
+    f.commit();
+    sync();
+    CHECK(results() == expected(items, "st"sv));
+
+    f.stop();
+  }
+
+  SECTION("NUMA mode") {
+    f.setThreads(4);
+    f.setNuma(true);
+
+    auto items = makeItems(40000);
+    for (const auto& item : items)
+      f.pushItem(item);
+    f.commit();
+    f.start();
+
+    for (auto query : { "s"sv, "src"sv, "lua"sv }) {
+      CAPTURE(query);
+      f.setQuery(query);
+      sync();
+      CHECK(results() == expected(items, query));
+    }
+
+    const auto more = makeItems(50000);
+    for (const auto& item : more)
+      f.pushItem(item);
+    items.insert(items.end(), more.begin(), more.end());
+    f.commit();
+    f.setQuery("src/f"sv);
+    sync();
+    CHECK(results() == expected(items, "src/f"sv));
+
+    f.stop();
+  }
+
+  SECTION("changing the number of threads while running") {
+    f.setThreads(2);
+    f.start();
+
+    auto items = makeItems(100000);
+    for (const auto& item : items)
+      f.pushItem(item);
+    f.commit();
+    f.setQuery("src"sv);
+    sync();
+    CHECK(results() == expected(items, "src"sv));
+
+    // The job starts again with the new workers, also when the results aren't there yet.
+    for (unsigned threads : { 6U, 1U, 3U }) {
+      CAPTURE(threads);
+      f.setThreads(threads);
+      f.commit();
+      sync();
+      CHECK(results() == expected(items, "src"sv));
+      f.setQuery("s"sv);
+      f.setThreads(threads + 1);
+      f.commit();
+      sync();
+      CHECK(results() == expected(items, "s"sv));
+      f.setQuery("src"sv);
+    }
+
+    // Picked automatically, and more of them as the items are appended.
+    f.setThreads(0);
+    f.setQuery("lua"sv);
+    sync();
+    CHECK(results() == expected(items, "lua"sv));
+    const auto more = makeItems(200000);
+    for (size_t i = 0; i < more.size(); ++i) {
+      f.pushItem(more[i]);
+      if (i % 20011 == 0)
+        f.commit();
+    }
+    items.insert(items.end(), more.begin(), more.end());
+    f.commit();
+    sync();
+    CHECK(results() == expected(items, "lua"sv));
+
+    f.stop();
+  }
+
+  SECTION("appending items under the same query") {
+    f.setThreads(4);
+    f.start();
+
+    const auto items = makeItems(100000);
+    f.setQuery("src/f"sv);
+    for (size_t i = 0; i < items.size(); ++i) {
+      f.pushItem(items[i]);
+      if (i % 7919 == 0)
+        f.commit();
+      if (i % 30011 == 0) {
+        f.commit();
+        sync();
+        CHECK(results() == expected({ items.begin(), items.begin() + i + 1 }, "src/f"sv));
+      }
+    }
+    f.commit();
+    sync();
+    CHECK(results() == expected(items, "src/f"sv));
+
+    // Narrow the query, then keep appending.
+    f.setQuery("src/fo"sv);
+    const auto more = makeItems(30000);
+    for (size_t i = 0; i < more.size(); ++i) {
+      f.pushItem(more[i]);
+      if (i % 4999 == 0)
+        f.commit();
+    }
+    f.commit();
+    sync();
+    auto all = items;
+    all.insert(all.end(), more.begin(), more.end());
+    CHECK(results() == expected(all, "src/fo"sv));
+
+    f.stop();
+  }
+
+  SECTION("going back to a previous query") {
+    f.setThreads(4);
+    f.start();
+
+    auto items = makeItems(50000);
+    for (const auto& item : items)
+      f.pushItem(item);
+    f.commit();
+
+    for (auto query : { "s"sv, "src"sv, "src f"sv, "src"sv, "s"sv, "lua"sv, "src f"sv }) {
+      CAPTURE(query);
+      f.setQuery(query);
+      sync();
+      CHECK(results() == expected(items, query));
+    }
+
+    // Cached results are used as they are, nothing is left to process.
+    f.setQuery("src"sv);
+    CHECK(f.progress() == 1.0);
+    sync();
+    CHECK(results() == expected(items, "src"sv));
+
+    // Only the items appended since the results were cached are processed.
+    f.setQuery("lua"sv);
+    sync();
+    const auto more = makeItems(20000);
+    for (const auto& item : more)
+      f.pushItem(item);
+    items.insert(items.end(), more.begin(), more.end());
+    f.commit();
+    sync();
+    CHECK(results() == expected(items, "lua"sv));
+    f.setQuery("src"sv);
+    sync();
+    CHECK(results() == expected(items, "src"sv));
+
+    f.stop();
+  }
+
+  SECTION("loading a file") {
+    f.setThreads(4);
+    f.start();
+
+    const auto items = makeItems(50000);
+    const auto path = std::filesystem::temp_directory_path() / "fzx-test-fzx.txt";
+    std::FILE* file = std::fopen(path.string().c_str(), "wb");
+    REQUIRE(file != nullptr);
+    for (const auto& item : items)
+      std::fprintf(file, "%s\n", item.c_str());
+    std::fclose(file);
+
+    f.loadFile(path.string().c_str());
+    f.commit();
+    std::filesystem::remove(path);
+    REQUIRE(f.itemsSize() == items.size());
+
+    for (auto query : { "s"sv, "src/f"sv, "'tch"sv, "^src lua$"sv, "BAR !foo"sv }) {
+      CAPTURE(query);
+      f.setQuery(query);
+      sync();
+      CHECK(results() == expected(items, query));
+    }
+
+    f.stop();
+  }
+
+  SECTION("limiting results") {
+    f.setThreads(4);
+    f.setResultsLimit(100);
+    f.start();
+
+    const auto items = makeItems(60000);
+    for (const auto& item : items)
+      f.pushItem(item);
+    f.commit();
+
+    auto check = [&](std::string_view query, size_t limit) {
+      auto all = expected(items, query);
+      REQUIRE(f.resultsSize() == all.size());
+      if (all.size() > limit)
+        all.resize(limit);
+      CHECK(results() == all);
+    };
+
+    f.setQuery("s"sv);
+    sync();
+    check("s"sv, 100);
+
+    // Results past the limit are computed on request.
+    f.reserveResults(150);
+    sync();
+    check("s"sv, 200);
+
+    // Limit goes back to the default when the query changes.
+    f.setQuery("sr"sv);
+    sync();
+    check("sr"sv, 100);
+
+    // Appended items can push out the previous results.
+    const auto more = makeItems(20000);
+    for (const auto& item : more)
+      f.pushItem(item);
+    f.commit();
+    sync();
+    auto combined = items;
+    combined.insert(combined.end(), more.begin(), more.end());
+    auto all = expected(combined, "sr"sv);
+    REQUIRE(f.resultsSize() == all.size());
+    all.resize(std::min<size_t>(all.size(), 100));
+    CHECK(results() == all);
+
+    // Truncated results are cached too. Going back to the previous query ends up with its own
+    // results for the first items, combined with the results for the appended items.
+    f.setQuery("s"sv);
+    sync();
+    all = expected(combined, "s"sv);
+    REQUIRE(f.resultsSize() == all.size());
+    all.resize(100);
+    CHECK(results() == all);
+
+    f.stop();
+  }
 }
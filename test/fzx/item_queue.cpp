@@ -0,0 +1,146 @@
+#include <catch2/catch_test_macros.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include <vector>
+
+#include "fzx/item_queue.hpp"
+#include "fzx/numa.hpp"
+#include "thread.hpp"
+
+TEST_CASE("fzx::ItemQueue")
+{
+  SECTION("single worker takes everything in order") {
+    fzx::ItemQueue queue { 1 };
+    size_t next = 0;
+    for (;;) {
+      const auto [start, end] = queue.take(0, 100, 1050);
+      if (start >= end)
+        break;
+      REQUIRE(start == next);
+      REQUIRE(end - start <= 100);
+      next = end;
+    }
+    REQUIRE(next == 1050);
+    REQUIRE(queue.get() == 1050);
+  }
+
+  SECTION("starts at the given index") {
+    fzx::ItemQueue queue { 4, 500 };
+    REQUIRE(queue.get() == 500);
+    const auto [start, end] = queue.take(2, 100, 1000);
+    REQUIRE(start == 500);
+    REQUIRE(end == 600);
+    REQUIRE(queue.take(2, 100, 500).first == queue.take(2, 100, 500).second);
+  }
+
+  SECTION("steals from other workers") {
+    fzx::ItemQueue queue { 2 };
+    // Worker 0 claims the first range and stalls.
+    const auto [start0, end0] = queue.take(0, 10, 100);
+    REQUIRE(start0 == 0);
+    REQUIRE(end0 == 10);
+    // Worker 1 takes the rest of the tail, then keeps stealing halves of what worker 0 has left.
+    std::vector<int> seen(100);
+    for (size_t i = start0; i < end0; ++i)
+      ++seen[i];
+    for (;;) {
+      const auto [start, end] = queue.take(1, 10, 100);
+      if (start >= end)
+        break;
+      for (size_t i = start; i < end; ++i)
+        ++seen[i];
+    }
+    // Worker 1 ended up with everything worker 0 didn't take before stalling.
+    REQUIRE(queue.get() == 100);
+    const auto [start, end] = queue.take(0, 10, 100);
+    REQUIRE(start >= end);
+    for (int n : seen)
+      REQUIRE(n == 1);
+  }
+
+  SECTION("workers claim items of their own node first") {
+    fzx::ItemQueue queue { 4 };
+    queue.shard({ 0, 1000, 2000 });
+    // Workers 0 and 1 are on node 0, workers 2 and 3 on node 1.
+    for (size_t w = 0; w < 4; ++w) {
+      const auto [start, end] = queue.take(w, 10, 2500, w / 2);
+      CAPTURE(w);
+      REQUIRE(end - start == 10);
+      REQUIRE(start / 1000 == w / 2);
+    }
+    REQUIRE(queue.get() == 40);
+
+    // Then the other node, then the items past the shards.
+    std::vector<int> seen(2500);
+    for (;;) {
+      const auto [start, end] = queue.take(0, 100, 2500);
+      if (start >= end)
+        break;
+      for (size_t i = start; i < end; ++i)
+        ++seen[i];
+    }
+    REQUIRE(queue.get() == 2500);
+    REQUIRE(std::count(seen.begin(), seen.end(), 1) == 2500 - 40);
+  }
+
+  SECTION("workers claim the shard of the node they are pinned to") {
+    // With the thread count set to auto, a small job has fewer workers than the pool is sized
+    // for. Fzx pins the workers by their index in the whole pool, so these all run on node 0.
+    constexpr size_t kPool = 64;
+    constexpr size_t kNodes = 3;
+    fzx::ItemQueue queue { 4 };
+    queue.shard({ 0, 1000, 2000, 3000 });
+    for (size_t w = 0; w < 4; ++w) {
+      const size_t node = fzx::numaNode(w, kPool, kNodes);
+      const auto [start, end] = queue.take(w, 10, 3500, node);
+      CAPTURE(w);
+      REQUIRE(node == 0);
+      REQUIRE(end - start == 10);
+      REQUIRE(start / 1000 == 0);
+    }
+    // A worker from the end of the pool is on the last node, and starts with its shard.
+    const size_t last = fzx::numaNode(kPool - 1, kPool, kNodes);
+    REQUIRE(last == kNodes - 1);
+    const auto [start, end] = queue.take(4, 10, 3500, last);
+    REQUIRE(end - start == 10);
+    REQUIRE(start / 1000 == last);
+  }
+
+  SECTION("shards start at the given index") {
+    fzx::ItemQueue queue { 2, 1500 };
+    queue.shard({ 0, 1000, 2000 });
+    REQUIRE(queue.get() == 1500);
+    const auto [start, end] = queue.take(0, 10, 3000);
+    REQUIRE(start == 1500);
+    REQUIRE(end == 1510);
+  }
+
+  SECTION("every item is taken once by concurrent workers, even when more are appended") {
+    constexpr size_t kWorkers = 8;
+    constexpr size_t kSize = 1 << 18;
+    auto seen = std::make_unique<std::atomic<int>[]>(kSize);
+    fzx::ItemQueue queue { kWorkers };
+
+    for (size_t max : { kSize / 4, kSize / 2 + 7, kSize }) {
+      std::vector<fzx::Thread> threads;
+      for (size_t w = 0; w < kWorkers; ++w) {
+        threads.emplace_back([&, w] {
+          for (;;) {
+            const auto [start, end] = queue.take(w, 1 + w * 37, max);
+            if (start >= end)
+              break;
+            for (size_t i = start; i < end; ++i)
+              seen[i].fetch_add(1, std::memory_order_relaxed);
+          }
+        });
+      }
+      threads.clear();
+      REQUIRE(queue.get() == max);
+      for (size_t i = 0; i < max; ++i)
+        REQUIRE(seen[i].load() == 1);
+    }
+  }
+}
@@ -1,5 +1,13 @@
 #include <catch2/catch_test_macros.hpp>
+
+#include <cstdio>
+#include <filesystem>
+#include <stdexcept>
+#include <string>
+#include <system_error>
+
 #include "fzx/items.hpp"
+#include "fzx/strings.hpp"
 
 TEST_CASE("fzx::Items")
 {
@@ -42,6 +50,93 @@ TEST_CASE("fzx::Items")
       REQUIRE(items.at(i) == "0123456789abcdef"sv);
   }
 
+  SECTION("character masks") {
+    fzx::Items items;
+    items.push("foo"sv);
+    items.push("Bar/Baz"sv);
+    for (size_t i = 0; i < 0x1000; ++i)
+      items.push("0123456789abcdef"sv);
+    REQUIRE(items.charMask(0) == fzx::charMask("foo"sv));
+    REQUIRE(items.charMask(0) == fzx::charMask("FOO"sv));
+    REQUIRE(items.charMask(1) == fzx::charMask("bar/baz"sv));
+    REQUIRE(items.charMask(1) != fzx::charMask("barbaz"sv));
+    REQUIRE(items.charMask(0x1000) == fzx::charMask("0123456789abcdef"sv));
+  }
+
+  SECTION("ASCII flags") {
+    fzx::Items items;
+    items.push("foo"sv);
+    items.push("caf\u00E9"sv);
+    items.push("\xFF"sv);
+    REQUIRE(items.isAscii(0));
+    REQUIRE(!items.isAscii(1));
+    REQUIRE(!items.isAscii(2));
+    REQUIRE(items.at(1) == "caf\u00E9"sv);
+  }
+
+  SECTION("mapping a file") {
+    const auto path = std::filesystem::temp_directory_path() / "fzx-test-items.txt";
+    auto write = [&](std::string_view data) {
+      std::FILE* f = std::fopen(path.string().c_str(), "wb");
+      REQUIRE(f != nullptr);
+      std::fwrite(data.data(), 1, data.size(), f);
+      std::fclose(f);
+    };
+
+    fzx::Items items;
+    SECTION("lines") {
+      write("foo\nBar/Baz\n\n\nx\n0123456789abcdef0123456789abcdef\nlast"sv);
+      items.mapFile(path.string().c_str());
+      REQUIRE(items.size() == 5);
+      REQUIRE(items.at(0) == "foo"sv);
+      REQUIRE(items.at(1) == "Bar/Baz"sv);
+      REQUIRE(items.at(2) == "x"sv);
+      REQUIRE(items.at(3) == "0123456789abcdef0123456789abcdef"sv);
+      REQUIRE(items.at(4) == "last"sv);
+      REQUIRE(items.charMask(1) == fzx::charMask("bar/baz"sv));
+      REQUIRE(items.maxStrSize() == 32);
+
+      SECTION("then push more items") {
+        fzx::Items copy = items;
+        items.push("pushed"sv);
+        REQUIRE(items.size() == 6);
+        REQUIRE(items.at(4) == "last"sv);
+        REQUIRE(items.at(5) == "pushed"sv);
+        REQUIRE(copy.size() == 5);
+        REQUIRE(copy.at(4) == "last"sv);
+      }
+    }
+
+    SECTION("other delimiter") {
+      write("foo\0bar\0"sv);
+      items.mapFile(path.string().c_str(), '\0');
+      REQUIRE(items.size() == 2);
+      REQUIRE(items.at(0) == "foo"sv);
+      REQUIRE(items.at(1) == "bar"sv);
+    }
+
+    SECTION("empty file") {
+      write(""sv);
+      items.mapFile(path.string().c_str());
+      REQUIRE(items.size() == 0);
+    }
+
+    SECTION("items are not empty") {
+      write("foo"sv);
+      items.push("bar"sv);
+      REQUIRE_THROWS_AS(items.mapFile(path.string().c_str()), std::logic_error);
+      REQUIRE(items.size() == 1);
+    }
+
+    SECTION("missing file") {
+      write(""sv);
+      std::filesystem::remove(path);
+      REQUIRE_THROWS_AS(items.mapFile(path.string().c_str()), std::system_error);
+    }
+
+    std::filesystem::remove(path);
+  }
+
   SECTION("clearing empty vector does nothing") {
     fzx::Items items;
     items.clear();
@@ -1,6 +1,8 @@
 #include <catch2/catch_test_macros.hpp>
 #include <catch2/catch_approx.hpp>
 
+#include <string>
+
 #include "fzx/config.hpp"
 #include "fzx/match.hpp"
 #include "fzx/aligned_string.hpp"
@@ -14,6 +16,13 @@ static inline AlignedString operator""_s(const char* data, size_t size)
   return { std::string_view { data, size }};
 }
 
+/// Longer haystacks, the kernels read whole chunks past them like in fzx::Items, see kOveralloc.
+static std::string haystack(std::string s)
+{
+  s.reserve(s.size() + kOveralloc);
+  return s;
+}
+
 TEST_CASE("fzx::matchFuzzy")
 {
   SECTION("exact match should return true") {
@@ -64,6 +73,47 @@ TEST_CASE("fzx::matchFuzzy")
     CHECK(matchFuzzy("ey"sv, "abcdefghijklmnopqrstuvwx01234567y"_s));
     CHECK(!matchFuzzy("ez"sv, "abcdefghijklmnopqrstuvwx01234567y"_s));
   }
+
+  SECTION("long haystacks") {
+    // Cover every chunk boundary of 16, 32 and 64 byte kernels
+    for (size_t len = 1; len <= 200; ++len) {
+      std::string s(len, '-');
+      s.back() = 'Z';
+      auto hs = AlignedString { s };
+      CAPTURE(len);
+      CHECK(matchFuzzy("z"sv, hs));
+      CHECK(matchFuzzy("-z"sv, hs) == (len > 1));
+      CHECK(!matchFuzzy("z-"sv, hs));
+      s[(len - 1) / 2] = 'a';
+      hs = AlignedString { s };
+      CHECK(matchFuzzy("az"sv, hs) == (len > 1));
+      CHECK(!matchFuzzy("za"sv, hs));
+    }
+  }
+
+  SECTION("bytes past the haystack are not matched") {
+    // Items are packed one after another, the next item follows the padding
+    auto hs = "abcdefghijklmnopqrstuvwxyz0123456789ABCDEFGHIJKLMN|xyz|abcdefghijklmnop"_s;
+    CHECK(matchFuzzy("n"sv, std::string_view { hs.data(), 48 }));
+    CHECK(!matchFuzzy("|"sv, std::string_view { hs.data(), 48 }));
+    CHECK(!matchFuzzy("n|"sv, std::string_view { hs.data(), 48 }));
+    CHECK(!matchFuzzy("|"sv, std::string_view { hs.data(), 32 }));
+    CHECK(!matchFuzzy("5|"sv, std::string_view { hs.data(), 32 }));
+  }
+}
+
+TEST_CASE("fzx::matchFuzzy unaligned")
+{
+  // Mapped items start anywhere and are followed by the next line
+  auto hs = "\nabcdefghijklmnopqrstuvwxyz0123456789\nzyx\nabc"_s;
+  for (size_t i = 1; i <= 36; ++i) {
+    auto s = std::string_view { hs.data() + i, 37 - i };
+    CAPTURE(s);
+    CHECK(matchFuzzy("9"sv, s));
+    CHECK(!matchFuzzy("\n"sv, s));
+    CHECK(!matchFuzzy("9z"sv, s));
+    CHECK(!matchFuzzy("9\n"sv, s));
+  }
 }
 
 TEST_CASE("fzx::matchBegin")
@@ -128,4 +178,89 @@ TEST_CASE("fzx::matchSubstr")
   CHECK(matchSubstrIndex("a"sv, ""_s) == -1);
   CHECK(matchSubstrIndex("ac"sv, "abc"_s) == -1);
   CHECK(matchSubstrIndex("d"sv, "abc"_s) == -1);
+
+  SECTION("case insensitive") {
+    CHECK(matchSubstrIndex("bC"sv, "ABCD"_s) == 1);
+    CHECK(matchSubstrIndex("xyz"sv, "abcdefghijklmnopqrstuvwXYZ"_s) == 23);
+    CHECK(matchSubstrIndex("[`"sv, "{@"_s) == -1);
+  }
+
+  SECTION("long haystacks") {
+    // Cover every chunk boundary of 16 and 32 byte kernels, also for the last needle character
+    const std::string needles[] { "z", "za", "z-a", "z-----------------a" };
+    for (const auto& needle : needles) {
+      const auto nd = AlignedString { needle };
+      for (size_t len = needle.size(); len <= 100; ++len) {
+        for (size_t pos = 0; pos + needle.size() <= len; pos += 7) {
+          std::string s(len, '-');
+          s.replace(pos, needle.size(), needle);
+          CAPTURE(needle, len, pos);
+          CHECK(matchSubstrIndex(nd, haystack(s)) == static_cast<int>(pos));
+          s[pos] = 'y'; // Only the first character differs
+          CHECK(matchSubstrIndex(nd, haystack(s)) == -1);
+        }
+      }
+    }
+  }
+
+  SECTION("bytes past the haystack are not matched") {
+    auto hs = "abcdefghijklmnopqrstuvwxyz0123456789ABCDEFGHIJKLMN|xyz|abcdefghijklmnop"_s;
+    CHECK(matchSubstrIndex("mn"sv, std::string_view { hs.data(), 48 }) == 12);
+    CHECK(matchSubstrIndex("mn|"sv, std::string_view { hs.data(), 48 }) == -1);
+    CHECK(matchSubstrIndex("n|x"sv, std::string_view { hs.data(), 49 }) == -1);
+    CHECK(matchSubstrIndex("gh"sv, std::string_view { hs.data(), 7 }) == -1);
+  }
+}
+
+TEST_CASE("fzx::matchBegin, fzx::matchEnd and fzx::matchExact long strings")
+{
+  for (size_t len = 1; len <= 100; ++len) {
+    std::string s;
+    for (size_t i = 0; i < len; ++i)
+      s += static_cast<char>('a' + i % 26);
+    const auto hs = haystack(s + "xyz");
+    std::string upper = s;
+    for (auto& ch : upper)
+      ch = static_cast<char>(ch - 'a' + 'A');
+    CAPTURE(len);
+    CHECK(matchBegin(AlignedString { upper }, hs));
+    CHECK(matchEnd(AlignedString { upper.substr(1) + "XYZ" }, hs));
+    CHECK(matchExact(AlignedString { upper + "XYZ" }, hs));
+    CHECK(!matchExact(AlignedString { upper }, hs));
+    upper.back() = '-';
+    CHECK(!matchBegin(AlignedString { upper }, hs));
+    CHECK(!matchEnd(AlignedString { upper + "xyz" }, hs));
+    CHECK(!matchExact(AlignedString { upper + "xyz" }, hs));
+  }
+}
+
+TEST_CASE("fzx::matchFuzzy and others case sensitive")
+{
+  // Lengths cover the short, medium and long kernels
+  for (size_t len : { 5, 20, 40, 80 }) {
+    const std::string pad(len - 4, '-');
+    const auto hs = haystack(pad + "aBcD");
+    CAPTURE(len);
+    CHECK(matchFuzzy<true>("aBD"sv, hs));
+    CHECK(matchFuzzy<true>("-a"sv, hs));
+    CHECK(!matchFuzzy<true>("abd"sv, hs));
+    CHECK(!matchFuzzy<true>("ABD"sv, hs));
+    CHECK(matchFuzzy<false>("ABD"sv, hs));
+
+    CHECK(matchSubstrIndex<true>("BcD"sv, hs) == static_cast<int>(len - 3));
+    CHECK(matchSubstrIndex<true>("bcd"sv, hs) == -1);
+    CHECK(matchSubstrIndex<false>("bcd"sv, hs) == static_cast<int>(len - 3));
+    CHECK(matchSubstr<true>("aB"sv, hs));
+    CHECK(!matchSubstr<true>("Ab"sv, hs));
+
+    CHECK(matchEnd<true>(AlignedString { "-aBcD" }, hs));
+    CHECK(!matchEnd<true>(AlignedString { "-abcd" }, hs));
+    CHECK(matchExact<true>(AlignedString { pad + "aBcD" }, hs));
+    CHECK(!matchExact<true>(AlignedString { pad + "abcd" }, hs));
+  }
+
+  CHECK(matchBegin<true>("Ab"sv, "Abc"_s));
+  CHECK(!matchBegin<true>("ab"sv, "Abc"_s));
+  CHECK(matchBegin<true>("[@"sv, "[@"_s));
+  CHECK(!matchBegin<true>("[@"sv, "{`"_s));
 }
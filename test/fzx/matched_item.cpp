@@ -74,4 +74,12 @@ TEST_CASE("fzx::MatchedItem")
     CHECK(MatchedItem { 0, kMin }.score() == kMin);
     CHECK(MatchedItem { 0, kMax }.score() == kMax);
   }
+
+  SECTION("clamps scores past the encoding") {
+    CHECK(MatchedItem { 0, -1e12F }.score() > kMin);
+    CHECK(MatchedItem { 0, 1e12F }.score() < kMax);
+    CHECK(MatchedItem { 0, 1e12F } < MatchedItem { 0, -1e12F });
+    CHECK(MatchedItem { 0, -1e12F } < MatchedItem { 0, kMin });
+    CHECK(MatchedItem { 0, kMax } < MatchedItem { 0, 1e12F });
+  }
 }
@@ -0,0 +1,31 @@
+#include <catch2/catch_test_macros.hpp>
+
+#include <vector>
+
+#include "fzx/numa.hpp"
+
+using namespace fzx;
+
+TEST_CASE("fzx::numa")
+{
+  SECTION("there is at least one node") {
+    CHECK(numaNodes() >= 1);
+    CHECK(numaNodes() == numaNodes());
+  }
+
+  SECTION("workers are split into contiguous blocks") {
+    std::vector<size_t> nodes;
+    for (size_t i = 0; i < 8; ++i)
+      nodes.push_back(numaNode(i, 8, 2));
+    CHECK(nodes == std::vector<size_t> { 0, 0, 0, 0, 1, 1, 1, 1 });
+    CHECK(numaNode(4, 6, 4) == 2);
+    CHECK(numaNode(5, 6, 4) == 3);
+    CHECK(numaNode(0, 1, 1) == 0);
+  }
+
+  SECTION("nodes that don't exist are rejected") {
+    std::vector<char> buffer(1 << 16);
+    CHECK(!pinThread(numaNodes()));
+    CHECK(!bindMemory(buffer.data(), buffer.size(), numaNodes()));
+  }
+}
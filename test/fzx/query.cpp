@@ -0,0 +1,407 @@
+#include <catch2/catch_test_macros.hpp>
+
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "fzx/aligned_string.hpp"
+#include "fzx/config.hpp"
+#include "fzx/items.hpp"
+#include "fzx/query.hpp"
+#include "fzx/score.hpp"
+#include "fzx/strings.hpp"
+
+using namespace std::string_view_literals;
+using namespace fzx;
+
+/// Copy of `s` with kOveralloc bytes past it readable, like the items in fzx::Items. The matchers
+/// load whole chunks.
+static std::string haystack(std::string_view s)
+{
+  std::string r;
+  r.reserve(s.size() + kOveralloc);
+  r.assign(s);
+  return r;
+}
+
+TEST_CASE("fzx::Query::refines")
+{
+  auto refines = [](std::string_view a, std::string_view b) {
+    return Query::parse(a).refines(Query::parse(b));
+  };
+
+  SECTION("same query") {
+    CHECK(refines("foo"sv, "foo"sv));
+    CHECK(refines("'foo ^bar baz$ !qux"sv, "'foo ^bar baz$ !qux"sv));
+  }
+
+  SECTION("extended needle") {
+    CHECK(refines("foo"sv, "fo"sv));
+    CHECK(refines("fxoxo"sv, "foo"sv));
+    CHECK(refines("FOO"sv, "fo"sv));
+    CHECK(refines("'foob"sv, "'foo"sv));
+    CHECK(refines("'afoo"sv, "'foo"sv));
+    CHECK(refines("^foob"sv, "^foo"sv));
+    CHECK(refines("afoo$"sv, "foo$"sv));
+    CHECK(refines("^foo$"sv, "^fo"sv));
+    CHECK(refines("^foo$"sv, "oo$"sv));
+    CHECK(!refines("fo"sv, "foo"sv));
+    CHECK(!refines("ofo"sv, "foo"sv));
+    CHECK(!refines("'fxoo"sv, "'foo"sv));
+    CHECK(!refines("^afoo"sv, "^foo"sv));
+    CHECK(!refines("foob$"sv, "foo$"sv));
+  }
+
+  SECTION("stricter match type") {
+    CHECK(refines("'foo"sv, "foo"sv));
+    CHECK(refines("^foo"sv, "'foo"sv));
+    CHECK(refines("foo$"sv, "'oo"sv));
+    CHECK(refines("^foo$"sv, "'foo"sv));
+    CHECK(!refines("foo"sv, "'foo"sv));
+    CHECK(!refines("'foo"sv, "^foo"sv));
+    CHECK(!refines("^foo"sv, "^foo$"sv));
+  }
+
+  SECTION("added term") {
+    CHECK(refines("foo bar"sv, "foo"sv));
+    CHECK(refines("foo !bar"sv, "foo"sv));
+    CHECK(refines("bar foo"sv, "foo"sv));
+    CHECK(!refines("foo"sv, "foo bar"sv));
+  }
+
+  SECTION("negated terms") {
+    CHECK(refines("!foo bar"sv, "!foo"sv));
+    CHECK(!refines("!fo"sv, "!foo"sv));
+    CHECK(!refines("!foo"sv, "!fo"sv));
+    CHECK(!refines("foo"sv, "!foo"sv));
+  }
+
+  SECTION("non-ASCII terms") {
+    // Compared by characters, not by bytes. "ã©" matches "ã©", "é" doesn't, but their bytes
+    // are C3 A3 C2 A9 and C3 A9.
+    CHECK(!refines("ã©"sv, "é"sv));
+    CHECK(!refines("'ã©"sv, "'é"sv));
+    CHECK(refines("éa"sv, "é"sv));
+    CHECK(refines("ÉCOLE"sv, "école"sv));
+    CHECK(refines("'école"sv, "'col"sv));
+    CHECK(refines("école"sv, "cl"sv));
+    CHECK(refines("^écoles"sv, "^école"sv));
+    CHECK(!refines("^école"sv, "^ecole"sv));
+  }
+}
+
+TEST_CASE("fzx::Query::mayMatch")
+{
+  auto mayMatch = [](std::string_view q, std::string_view s) {
+    return Query::parse(q).mayMatch(charMask(s));
+  };
+
+  CHECK(mayMatch(""sv, ""sv));
+  CHECK(mayMatch(""sv, "abc"sv));
+  CHECK(mayMatch("abc"sv, "cba"sv));
+  CHECK(mayMatch("ABC"sv, "c/b/a"sv));
+  CHECK(mayMatch("'a.b ^c d$"sv, "a.b/cd"sv));
+  CHECK(mayMatch("a !x"sv, "a"sv));
+  CHECK(!mayMatch("abc"sv, "ab"sv));
+  CHECK(!mayMatch("a.b"sv, "ab"sv));
+  CHECK(!mayMatch("a 'b"sv, "a"sv));
+  CHECK(!mayMatch("1"sv, "a"sv));
+
+  // Never rejects anything that matches
+  Items items;
+  for (auto item : { "src/fzx/query.cpp"sv, "test/fzx/Query.cpp"sv, "README.md"sv, "a-b_c d"sv })
+    items.push(item);
+  for (auto q : { "fzx"sv, "'.cpp"sv, "^src"sv, "md$"sv, "^a-b_c d$"sv, "rdm"sv, "q !z"sv }) {
+    auto query = Query::parse(q);
+    for (size_t i = 0; i < items.size(); ++i) {
+      CAPTURE(q, items.at(i));
+      if (query.match(items.at(i)))
+        CHECK(query.mayMatch(items.charMask(i)));
+    }
+  }
+}
+
+TEST_CASE("fzx::Query::score batch")
+{
+  Items items;
+  for (auto item : {
+           "a"sv,
+           "ab"sv,
+           "abc"sv,
+           "/abc/"sv,
+           "xyz"sv,
+           "src/fzx/query.cpp"sv,
+           "src/fzx/score.cpp"sv,
+           "test/fzx/query.cpp"sv,
+           "A/B/C"sv,
+           "aaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaabc"sv,
+           "ccc bbb aaa"sv,
+           "a_b_c"sv,
+           "aBc"sv,
+           "Abc.cpp"sv,
+       })
+    items.push(item);
+
+  for (auto q : { "a"sv, "ab"sv, "abc"sv, "c"sv, "abcd"sv, "a b"sv, "ab 'c"sv, "sc !x"sv }) {
+    CAPTURE(q);
+    auto query = Query::parse(q);
+    // Only matching items are ever scored
+    std::vector<std::string_view> matched;
+    for (size_t i = 0; i < items.size(); ++i)
+      if (query.match(items.at(i)))
+        matched.push_back(items.at(i));
+
+    std::vector<Score> scores(matched.size());
+    query.score(matched.data(), scores.data(), matched.size());
+    for (size_t i = 0; i < matched.size(); ++i) {
+      CAPTURE(matched[i]);
+      CHECK(scores[i] == query.score(matched[i]));
+    }
+  }
+}
+
+TEST_CASE("fzx::Query::matchRanges")
+{
+  auto ranges = [](std::string_view q, std::string_view s) {
+    std::vector<MatchRange> r;
+    Query::parse(q).matchRanges(haystack(s), r);
+    return r;
+  };
+  using Ranges = std::vector<MatchRange>;
+
+  CHECK(ranges("abc"sv, "xaxbcx"sv) == Ranges { { 1, 2 }, { 3, 5 } });
+  CHECK(ranges("abc"sv, "abc"sv) == Ranges { { 0, 3 } });
+  // Overlapping and touching terms are merged
+  CHECK(ranges("^xa ab"sv, "xabx"sv) == Ranges { { 0, 3 } });
+  CHECK(ranges("^xa bx$"sv, "xabx"sv) == Ranges { { 0, 4 } });
+  // All bytes of the matched characters
+  CHECK(ranges("\u00E9"sv, "a\u00E9b"sv) == Ranges { { 1, 3 } });
+  // Longer than the score DP table
+  const std::string padding(3000, '-');
+  CHECK(ranges("abc"sv, padding + "abc" + padding) == Ranges { { 3000, 3003 } });
+
+  SECTION("appends") {
+    std::vector<MatchRange> r;
+    const auto query = Query::parse("ab"sv);
+    query.matchRanges(haystack("ab"sv), r);
+    query.matchRanges(haystack("xaxb"sv), r);
+    CHECK(r == Ranges { { 0, 2 }, { 1, 2 }, { 3, 4 } });
+  }
+}
+
+TEST_CASE("fzx::Query unicode")
+{
+  auto match = [](std::string_view q, std::string_view s) {
+    return Query::parse(q).match(haystack(s));
+  };
+  auto positions = [](std::string_view q, std::string_view s) {
+    std::vector<bool> r;
+    Query::parse(q).matchPositions(haystack(s), r);
+    return r;
+  };
+
+  SECTION("match") {
+    CHECK(match("\u00E9"sv, "\u00C9"sv));
+    CHECK(match("\u00C9"sv, "\u00E9"sv));
+    CHECK(match("\u00C9COLE"sv, "docs/\u00E9cole.txt"sv));
+    CHECK(match("'\u00C9cole"sv, "docs/\u00E9cole.txt"sv));
+    CHECK(match("^\u00E9c"sv, "\u00C9cole"sv));
+    CHECK(match("\u00E9cole$"sv, "\u00C9COLE"sv));
+    CHECK(match("^\u00E9cole$"sv, "\u00C9COLE"sv));
+    CHECK(match("\u0436\u0443\u043A"sv, "\u0416\u0423\u041A.txt"sv));
+    CHECK(match("'\u4E2D\u6587"sv, "doc/\u4E2D\u6587.md"sv));
+    CHECK(match("cole"sv, "\u00C9COLE"sv));
+    CHECK(!match("\u00E9"sv, "e"sv));
+    CHECK(!match("e"sv, "\u00E9"sv));
+    CHECK(!match("'\u4E2D\u6587"sv, "doc/\u6587\u4E2D.md"sv));
+    CHECK(!match("\u00E9 !\u00C9"sv, "\u00E9"sv));
+  }
+
+  SECTION("score") {
+    auto query = Query::parse("\u00E9c"sv);
+    CHECK(query.score("\u00C9cole"sv) > query.score("\u00E9tude.c"sv));
+    CHECK(query.score("x/\u00E9cole"sv) == query.score("x/\u00C9cole"sv));
+    CHECK(query.score("x\u00C9cole"sv) > query.score("x\u00E9cole"sv)); // Camel case
+    CHECK(Query::parse("dc"sv).score("d\u00E9c"sv) > 0);
+  }
+
+  SECTION("positions cover whole characters") {
+    auto r = positions("\u00E9c"sv, "a\u00C9c"sv);
+    CHECK(r == std::vector<bool> { false, true, true, true });
+    r = positions("'\u4E2D"sv, "a\u4E2D"sv);
+    CHECK(r == std::vector<bool> { false, true, true, true });
+    r = positions("a"sv, "\u00E9a"sv);
+    CHECK(r == std::vector<bool> { false, false, true });
+    r = positions("\u00E9$"sv, "\u00E9a\u00E9"sv);
+    CHECK(r == std::vector<bool> { false, false, false, true, true });
+  }
+}
+
+TEST_CASE("fzx::Query case modes")
+{
+  auto match = [](std::string_view q, std::string_view s, CaseMode mode) {
+    return Query::parse(q, mode).match(haystack(s));
+  };
+
+  SECTION("insensitive") {
+    CHECK(match("Foo"sv, "foo"sv, CaseMode::kInsensitive));
+    CHECK(match("foo"sv, "FOO"sv, CaseMode::kInsensitive));
+  }
+
+  SECTION("sensitive") {
+    CHECK(match("Foo"sv, "Foo.cpp"sv, CaseMode::kSensitive));
+    CHECK(!match("Foo"sv, "foo.cpp"sv, CaseMode::kSensitive));
+    CHECK(!match("foo"sv, "Foo.cpp"sv, CaseMode::kSensitive));
+    CHECK(match("'oo. ^F cpp$"sv, "Foo.cpp"sv, CaseMode::kSensitive));
+    CHECK(!match("^f"sv, "Foo.cpp"sv, CaseMode::kSensitive));
+    CHECK(match("!foo"sv, "Foo.cpp"sv, CaseMode::kSensitive));
+    CHECK(match("École"sv, "École"sv, CaseMode::kSensitive));
+    CHECK(!match("école"sv, "École"sv, CaseMode::kSensitive));
+  }
+
+  SECTION("smart") {
+    CHECK(match("foo"sv, "FOO"sv, CaseMode::kSmart));
+    CHECK(match("Foo"sv, "Foo"sv, CaseMode::kSmart));
+    CHECK(!match("Foo"sv, "foo"sv, CaseMode::kSmart));
+    // Resolved for each term
+    CHECK(match("Foo bar"sv, "Foo/BAR"sv, CaseMode::kSmart));
+    CHECK(!match("Foo bar"sv, "foo/BAR"sv, CaseMode::kSmart));
+    CHECK(match("é"sv, "É"sv, CaseMode::kSmart));
+    CHECK(!match("É"sv, "é"sv, CaseMode::kSmart));
+  }
+
+  SECTION("positions") {
+    std::vector<bool> positions;
+    Query::parse("F"sv, CaseMode::kSensitive).matchPositions(haystack("fooF"sv), positions);
+    CHECK(positions == std::vector<bool> { false, false, false, true });
+    Query::parse("'O"sv, CaseMode::kSensitive).matchPositions(haystack("oO"sv), positions);
+    CHECK(positions == std::vector<bool> { false, true });
+  }
+
+  SECTION("score") {
+    // Scored on the alignment the case sensitive matcher accepts, not on the lowercase copy
+    // that gets the better bonus
+    for (auto q : { "F"sv, "FB"sv, "FoB"sv, "FooBar"sv, "FooBarBazQuxFooBar"sv }) {
+      CAPTURE(q);
+      const Query query = Query::parse(q, CaseMode::kSensitive);
+      std::string lower { q };
+      for (auto& ch : lower)
+        ch = toLower(ch);
+      Items items;
+      for (auto sep : { "x"sv, "x/"sv, "_x"sv, "-x_"sv })
+        items.push("/" + lower + std::string { sep } + std::string { q } + ".cpp");
+      std::vector<std::string_view> strings;
+      for (size_t i = 0; i < items.size(); ++i)
+        strings.push_back(items.at(i));
+
+      std::vector<Score> scores(strings.size());
+      query.score(strings.data(), scores.data(), strings.size());
+      for (size_t i = 0; i < strings.size(); ++i) {
+        CAPTURE(strings[i]);
+        CHECK(query.score(strings[i]) == matchPositions(q, strings[i], nullptr, true));
+        CHECK(scores[i] == query.score(strings[i]));
+      }
+      CHECK(query.score(strings[0]) != matchPositions(q, strings[0], nullptr, false));
+    }
+  }
+
+  SECTION("refines") {
+    auto refines = [](std::string_view a, CaseMode am, std::string_view b, CaseMode bm) {
+      return Query::parse(a, am).refines(Query::parse(b, bm));
+    };
+    CHECK(refines("Foo"sv, CaseMode::kSensitive, "fo"sv, CaseMode::kInsensitive));
+    CHECK(refines("Foo"sv, CaseMode::kSensitive, "Fo"sv, CaseMode::kSensitive));
+    CHECK(refines("Foo"sv, CaseMode::kSmart, "F"sv, CaseMode::kSmart));
+    CHECK(!refines("Foo"sv, CaseMode::kSensitive, "fo"sv, CaseMode::kSensitive));
+    CHECK(!refines("Foo"sv, CaseMode::kInsensitive, "Fo"sv, CaseMode::kSensitive));
+    CHECK(!refines("foo"sv, CaseMode::kSmart, "Fo"sv, CaseMode::kSmart));
+  }
+}
+
+TEST_CASE("fzx::Query plan")
+{
+  Items items;
+  for (auto item : {
+           "src/fzx/query.cpp"sv,
+           "src/fzx/score.cpp"sv,
+           "test/fzx/query.cpp"sv,
+           "README.md"sv,
+           "docs/école.md"sv,
+           "docs/ÉCOLE.txt"sv,
+           "query"sv,
+       })
+    items.push(item);
+
+  SECTION("order of terms doesn't change the results") {
+    const std::pair<std::string_view, std::string_view> queries[] {
+      { "qry ^src .cpp$"sv, ".cpp$ ^src qry"sv },
+      { "fzx !test 'query"sv, "'query !test fzx"sv },
+      { "éc md$"sv, "md$ éc"sv },
+      { "^query$ q"sv, "q ^query$"sv },
+    };
+    for (const auto& [a, b] : queries) {
+      CAPTURE(a, b);
+      auto qa = Query::parse(a);
+      auto qb = Query::parse(b);
+      for (size_t i = 0; i < items.size(); ++i) {
+        CAPTURE(items.at(i));
+        CHECK(qa.match(items.at(i)) == qb.match(items.at(i)));
+        if (qa.match(items.at(i)))
+          CHECK(qa.score(items.at(i)) == qb.score(items.at(i)));
+      }
+    }
+  }
+
+  SECTION("matchScore is the same as match and score") {
+    for (auto q : { "q"sv, "qry ^src"sv, "éc"sv, "md$"sv, "!x"sv, "d c !txt"sv }) {
+      auto query = Query::parse(q);
+      for (size_t i = 0; i < items.size(); ++i) {
+        CAPTURE(q, items.at(i));
+        Score score = -1;
+        const bool ascii = items.isAscii(i);
+        const bool matched = query.matchScore(items.at(i), ascii, score);
+        CHECK(matched == query.match(items.at(i)));
+        if (matched)
+          CHECK(score == query.score(items.at(i)));
+      }
+    }
+  }
+}
+
+TEST_CASE("fzx::Query::score only scores where the needle can match")
+{
+  // Deterministic strings, with the same characters showing up many times
+  std::vector<std::string> haystacks;
+  uint32_t state = 1;
+  auto next = [&state]() {
+    state = state * 1103515245 + 12345;
+    return (state >> 16) & 0x7FFF;
+  };
+  constexpr std::string_view kChars = "abcAB/._- x";
+  for (size_t i = 0; i < 300; ++i) {
+    std::string s(1 + next() % 100, ' ');
+    for (auto& ch : s)
+      ch = kChars[next() % kChars.size()];
+    haystacks.push_back(haystack(s));
+  }
+
+  for (auto q :
+       { "a"sv, "x"sv, "ab"sv, "b/c"sv, "a.b_c"sv, "abcabcabc"sv, "aaaaaaaaaaaaaaaaa"sv }) {
+    auto query = Query::parse(q);
+    std::vector<std::string_view> matched;
+    for (const auto& hs : haystacks)
+      if (query.match(hs))
+        matched.push_back(hs);
+    CAPTURE(q, matched.size());
+
+    std::vector<Score> scores(matched.size());
+    query.score(matched.data(), scores.data(), matched.size());
+    for (size_t i = 0; i < matched.size(); ++i) {
+      CAPTURE(matched[i]);
+      const Score expected = fzx::score(AlignedString { q }, matched[i]);
+      CHECK(query.score(matched[i]) == expected);
+      CHECK(scores[i] == expected);
+    }
+  }
+}
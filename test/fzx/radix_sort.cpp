@@ -0,0 +1,72 @@
+#include <catch2/catch_test_macros.hpp>
+
+#include <algorithm>
+#include <cstdint>
+#include <limits>
+#include <random>
+#include <vector>
+
+#include "fzx/matched_item.hpp"
+#include "fzx/radix_sort.hpp"
+
+using fzx::MatchedItem;
+
+TEST_CASE("fzx::radixSort")
+{
+  constexpr auto kInf = std::numeric_limits<float>::infinity();
+  std::mt19937 rng { 1234 };
+  std::vector<MatchedItem> items;
+  std::vector<MatchedItem> tmp;
+
+  auto check = [&] {
+    auto expected = items;
+    std::sort(expected.begin(), expected.end());
+    fzx::radixSort(items, tmp);
+    CHECK(items == expected);
+  };
+
+  SECTION("empty and small") {
+    check();
+    items = { { 3, 1.F }, { 1, 2.F }, { 2, 1.F } };
+    check();
+  }
+
+  SECTION("narrow range of scores") {
+    // Only the lowest score byte and the two lowest index bytes differ
+    for (uint32_t i = 0; i < 5000; ++i)
+      items.emplace_back(i * 7919 % 50000, static_cast<float>(rng() % 200));
+    check();
+  }
+
+  SECTION("negative and infinite scores") {
+    for (uint32_t i = 0; i < 3000; ++i) {
+      float score = static_cast<float>(static_cast<int32_t>(rng() % 2000) - 1000);
+      if (i % 100 == 0)
+        score = i % 200 == 0 ? kInf : -kInf;
+      items.emplace_back(i, score);
+    }
+    check();
+  }
+
+  SECTION("all the bytes differ") {
+    for (uint32_t i = 0; i < 4000; ++i)
+      items.emplace_back(rng(), static_cast<float>(static_cast<int32_t>(rng() % 0x7FFFFF)));
+    check();
+  }
+
+  SECTION("same score and already sorted") {
+    for (uint32_t i = 0; i < 2000; ++i)
+      items.emplace_back(i, 5.F);
+    check();
+    check();
+  }
+
+  SECTION("reuses the scratch vector") {
+    for (uint32_t i = 0; i < 2000; ++i)
+      items.emplace_back(2000 - i, static_cast<float>(i % 10));
+    check();
+    for (auto& item : items)
+      item = MatchedItem { item.index() + 0x10000, item.score() + 300 };
+    check();
+  }
+}
@@ -0,0 +1,81 @@
+#include <catch2/catch_test_macros.hpp>
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "fzx/config.hpp"
+#include "fzx/matched_item.hpp"
+#include "fzx/query.hpp"
+#include "fzx/results_cache.hpp"
+
+using namespace std::string_literals;
+
+TEST_CASE("fzx::ResultsCache")
+{
+  fzx::ResultsCache cache;
+  auto query = [](const std::string& s) {
+    return std::make_shared<fzx::Query>(fzx::Query::parse(s));
+  };
+  const auto items = std::make_shared<const std::vector<fzx::MatchedItem>>(
+      std::vector<fzx::MatchedItem> { { 3, 5.F }, { 1, 2.F }, { 0, 1.F } });
+
+  SECTION("finds results by query") {
+    cache.insert(query("foo"s), items, items->size(), 10);
+    const auto* e = cache.find(*query("foo"s), 10, 0);
+    REQUIRE(e != nullptr);
+    CHECK(e->mItems == items); // Shared, not copied
+    CHECK(e->mMatched == items->size());
+    CHECK(e->mItemsTick == 10);
+    CHECK(cache.find(*query("fo"s), 10, 0) == nullptr);
+    CHECK(cache.find(*query("foo bar"s), 10, 0) == nullptr);
+  }
+
+  SECTION("results for more items can't be used") {
+    cache.insert(query("foo"s), items, items->size(), 10);
+    CHECK(cache.find(*query("foo"s), 9, 0) == nullptr);
+    CHECK(cache.find(*query("foo"s), 11, 0) != nullptr);
+  }
+
+  SECTION("truncated results are found only for a small enough limit") {
+    cache.insert(query("foo"s), items, 100, 10);
+    CHECK(cache.find(*query("foo"s), 10, 0) == nullptr);
+    CHECK(cache.find(*query("foo"s), 10, 4) == nullptr);
+    CHECK(cache.find(*query("foo"s), 10, 3) != nullptr);
+    CHECK(cache.find(*query("foo"s), 10, 2) != nullptr);
+  }
+
+  SECTION("replaces results for the same query") {
+    cache.insert(query("foo"s), items, items->size(), 10);
+    const auto* e = cache.find(*query("foo"s), 20, 0);
+    REQUIRE(e != nullptr);
+    const auto shared = e->mItems;
+
+    // Same results truncated more, the cached ones are kept.
+    auto first = std::make_shared<const std::vector<fzx::MatchedItem>>(1, (*items)[0]);
+    cache.insert(query("foo"s), first, items->size(), 10);
+    CHECK(cache.size() == 1);
+    CHECK(cache.find(*query("foo"s), 20, 0)->mItems == shared);
+
+    cache.insert(query("foo"s), first, 1, 20);
+    CHECK(cache.size() == 1);
+    e = cache.find(*query("foo"s), 20, 0);
+    REQUIRE(e != nullptr);
+    CHECK(e->mItems->size() == 1);
+    CHECK(e->mItemsTick == 20);
+    CHECK(e->mItems == first);
+  }
+
+  SECTION("drops the least recently used results") {
+    for (size_t i = 0; i < fzx::kResultsCacheSize; ++i)
+      cache.insert(query("q"s + std::to_string(i)), items, items->size(), 10);
+    CHECK(cache.size() == fzx::kResultsCacheSize);
+    REQUIRE(cache.find(*query("q0"s), 10, 0) != nullptr);
+
+    cache.insert(query("new"s), items, items->size(), 10);
+    CHECK(cache.size() == fzx::kResultsCacheSize);
+    CHECK(cache.find(*query("q0"s), 10, 0) != nullptr);
+    CHECK(cache.find(*query("q1"s), 10, 0) == nullptr);
+    CHECK(cache.find(*query("new"s), 10, 0) != nullptr);
+  }
+}
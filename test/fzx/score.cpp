@@ -1,8 +1,17 @@
 #include <catch2/catch_test_macros.hpp>
 #include <catch2/catch_approx.hpp>
 
+#include <algorithm>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "fzx/aligned_string.hpp"
 #include "fzx/config.hpp"
 #include "fzx/score.hpp"
+#include "fzx/strings.hpp"
 
 using namespace std::string_literals;
 using namespace std::string_view_literals;
@@ -17,6 +26,58 @@ static inline std::string operator""_s(const char* data, size_t size)
   return s;
 }
 
+/// Straightforward DP over the whole haystack, as described in fzy. ASCII only.
+static Score referenceScore(std::string_view needle,
+                            std::string_view haystack,
+                            bool caseSensitive = false)
+{
+  if (needle.size() == haystack.size())
+    return kScoreMax;
+
+  auto bonus = [](char prev, char ch) -> Score {
+    const bool upper = ch >= 'A' && ch <= 'Z';
+    if (!upper && !(ch >= 'a' && ch <= 'z') && !(ch >= '0' && ch <= '9'))
+      return 0;
+    switch (prev) {
+    case '/':
+      return kScoreMatchSlash;
+    case '-':
+    case '_':
+    case ' ':
+      return kScoreMatchWord;
+    case '.':
+      return kScoreMatchDot;
+    default:
+      return upper && prev >= 'a' && prev <= 'z' ? kScoreMatchCapital : 0;
+    }
+  };
+
+  const size_t n = needle.size();
+  const size_t m = haystack.size();
+  std::vector<Score> d(n * m, kScoreMin);
+  std::vector<Score> best(n * m, kScoreMin);
+  for (size_t i = 0; i < n; ++i) {
+    const Score gap = i == n - 1 ? kScoreGapTrailing : kScoreGapInner;
+    Score prev = kScoreMin;
+    for (size_t j = 0; j < m; ++j) {
+      Score s = kScoreMin;
+      const bool eq = caseSensitive ? needle[i] == haystack[j]
+                                    : toLower(needle[i]) == toLower(haystack[j]);
+      if (eq) {
+        const Score b = bonus(j > 0 ? haystack[j - 1] : '/', haystack[j]);
+        if (i == 0)
+          s = (static_cast<Score>(j) * kScoreGapLeading) + b;
+        else if (j > 0)
+          s = std::max(best[((i - 1) * m) + j - 1] + b,
+                       d[((i - 1) * m) + j - 1] + kScoreMatchConsecutive);
+      }
+      d[(i * m) + j] = s;
+      best[(i * m) + j] = prev = std::max(s, prev + gap);
+    }
+  }
+  return best[(n * m) - 1];
+}
+
 TEST_CASE("fzx::score", "[score]")
 {
   SECTION("should prefer starts of words") {
@@ -105,9 +166,10 @@ TEST_CASE("fzx::score", "[score]")
     char buf[4096] {};
     memset(buf, 'a', std::size(buf) - 1);
     std::string_view str { buf, std::size(buf) - 1 };
-    CHECK(Approx(kScoreMin) == score("aa"sv, str));
+    const auto trailing = kScoreGapTrailing * static_cast<Score>(str.size() - 2);
+    CHECK(Approx(kScoreMatchSlash + kScoreMatchConsecutive + trailing) == score("aa"sv, str));
     CHECK(Approx(kScoreMin) == score(str, "aa"_s));
-    CHECK(Approx(kScoreMin) == score(str, str));
+    CHECK(Approx(kScoreMax) == score(str, str));
   }
 
   SECTION("positions consecutive") {
@@ -226,6 +288,202 @@ TEST_CASE("fzx::score", "[score]")
   }
 }
 
+TEST_CASE("fzx::score only scores where the needle can match", "[score]")
+{
+  // Deterministic strings, with the same characters showing up many times
+  std::vector<std::string> haystacks;
+  uint32_t state = 1;
+  auto next = [&state]() {
+    state = state * 1103515245 + 12345;
+    return (state >> 16) & 0x7FFF;
+  };
+  constexpr std::string_view kChars = "abcAB/._- x";
+  for (size_t i = 0; i < 300; ++i) {
+    std::string s(1 + next() % 100, ' ');
+    s.reserve(s.size() + kOveralloc); // The kernels load whole blocks, see operator""_s
+    for (auto& ch : s)
+      ch = kChars[next() % kChars.size()];
+    haystacks.push_back(std::move(s));
+  }
+
+  for (auto t : { "a"sv, "x"sv, "ab"sv, "b/c"sv, "a.b_c"sv, "abcabcabc"sv,
+                  "aaaaaaaaaaaaaaaaa"sv }) {
+    CAPTURE(t);
+    const AlignedString n { t };
+    std::vector<std::string_view> matched;
+    for (const auto& hs : haystacks)
+      if (referenceScore(t, hs) != kScoreMin)
+        matched.push_back(hs);
+
+    for (auto hs : matched) {
+      CAPTURE(hs);
+      const Score expected = referenceScore(t, hs);
+      CHECK(score(n, hs) == expected);
+      CHECK(matchPositions(t, hs, nullptr) == expected);
+      if (t.size() == 1)
+        CHECK(score1(n, hs) == expected);
+#if defined(FZX_SSE2)
+      // Kernels are picked by the needle size, like in fzx::Query
+      if (t.size() <= 4)
+        CHECK(scoreSSE<4>(n, hs) == expected);
+      else if (t.size() <= 8)
+        CHECK(scoreSSE<8>(n, hs) == expected);
+      else if (t.size() <= 12)
+        CHECK(scoreSSE<12>(n, hs) == expected);
+      else if (t.size() <= 16)
+        CHECK(scoreSSE<16>(n, hs) == expected);
+      CHECK(scoreSSELong(n, hs) == expected);
+#endif
+#if defined(FZX_NEON)
+      if (t.size() <= 4)
+        CHECK(scoreNeon<4>(n, hs) == expected);
+      else if (t.size() <= 8)
+        CHECK(scoreNeon<8>(n, hs) == expected);
+      else if (t.size() <= 12)
+        CHECK(scoreNeon<12>(n, hs) == expected);
+      else if (t.size() <= 16)
+        CHECK(scoreNeon<16>(n, hs) == expected);
+#endif
+
+      std::u32string needle32 { t.begin(), t.end() };
+      std::u32string hs32 { hs.begin(), hs.end() };
+      CHECK(scoreUnicode(needle32, hs32) == matchPositionsUnicode(needle32, hs32, nullptr));
+    }
+
+#if defined(FZX_SSE2)
+    if (t.size() <= 3) {
+      for (size_t i = 0; i + kScoreBatch <= matched.size(); i += kScoreBatch) {
+        Score scores[kScoreBatch];
+        if (t.size() == 1)
+          scoreBatchSSE<1>(n, matched.data() + i, scores);
+        else if (t.size() == 2)
+          scoreBatchSSE<2>(n, matched.data() + i, scores);
+        else
+          scoreBatchSSE<3>(n, matched.data() + i, scores);
+        for (size_t j = 0; j < kScoreBatch; ++j) {
+          CAPTURE(matched[i + j]);
+          CHECK(scores[j] == referenceScore(t, matched[i + j]));
+        }
+      }
+    }
+#endif
+  }
+}
+
+TEST_CASE("fzx::score long haystacks", "[score]")
+{
+  // Haystacks longer than kMatchMaxLen are scored like any other. Where the needle can match
+  // fits in kMatchMaxLen in the first few, so fzx::matchPositions finds positions there.
+  const std::string padding(3000, '-');
+  const std::vector<AlignedString> haystacks = [&] {
+    std::vector<AlignedString> r;
+    r.emplace_back(padding + "src/fzx/score.cpp" + padding);
+    r.emplace_back(padding + "Src_Fzx_Score" + padding + "cpp");
+    r.emplace_back("s" + padding + "rc/fzx/score.cpp");
+    r.emplace_back("/src" + padding + "/fzx" + padding + "/score" + padding + ".cpp");
+    return r;
+  }();
+
+  for (auto t : { "s"sv, "src"sv, "fzx"sv, "scp"sv, "srcfzxscorecpp"sv }) {
+    CAPTURE(t);
+    const AlignedString n { t };
+    for (const auto& h : haystacks) {
+      const std::string_view hs = h;
+      CAPTURE(hs.size());
+      const Score expected = referenceScore(t, hs);
+      CHECK(expected != kScoreMin);
+      CHECK(score(n, hs) == expected);
+      CHECK(matchPositions(t, hs, nullptr) == expected);
+      if (t.size() == 1)
+        CHECK(score1(n, hs) == expected);
+#if defined(FZX_SSE2)
+      if (t.size() <= 4)
+        CHECK(scoreSSE<4>(n, hs) == expected);
+      else if (t.size() <= 16)
+        CHECK(scoreSSE<16>(n, hs) == expected);
+      CHECK(scoreSSELong(n, hs) == expected);
+#endif
+      std::u32string needle32 { t.begin(), t.end() };
+      std::u32string hs32 { hs.begin(), hs.end() };
+      CHECK(scoreUnicode(needle32, hs32) == expected);
+      CHECK(matchPositionsUnicode(needle32, hs32, nullptr) == expected);
+    }
+  }
+
+  SECTION("positions") {
+    const std::string_view hs = haystacks[0];
+    std::vector<bool> positions(hs.size());
+    matchPositions("fzx"sv, hs, &positions);
+    std::vector<bool> expected(hs.size());
+    for (size_t i = 0; i < 3; ++i)
+      expected[padding.size() + 4 + i] = true;
+    CHECK(positions == expected);
+  }
+}
+
+TEST_CASE("fzx::score case sensitive", "[score]")
+{
+  // The lowercase copy gets the better bonus and is the best case insensitive alignment, the
+  // case sensitive scorers may only use the characters after it.
+  for (auto t : { "F"sv, "FB"sv, "FoB"sv, "FooBarBaz"sv, "FooBarBazQuxFooBarBaz"sv }) {
+    CAPTURE(t);
+    const AlignedString n { t };
+    std::string lower { t };
+    for (auto& ch : lower)
+      ch = toLower(ch);
+    std::vector<std::string> haystacks;
+    haystacks.emplace_back("/" + lower + "x" + std::string { t });
+    haystacks.emplace_back("_" + lower + "x" + std::string { t } + ".cpp");
+    haystacks.emplace_back(lower + std::string(kMatchMaxLen, '-') + "x" + std::string { t });
+    haystacks.emplace_back("x/" + lower + "-" + std::string { t });
+    for (auto& h : haystacks)
+      h.reserve(h.size() + kOveralloc); // Batch kernel loads whole blocks, like from fzx::Items
+
+    for (const auto& h : haystacks) {
+      const std::string_view hs = h;
+      CAPTURE(hs.size());
+      const Score expected = referenceScore(t, hs, true);
+      CHECK(expected != referenceScore(t, hs));
+      CHECK(score<true>(n, hs) == expected);
+      CHECK(matchPositions(t, hs, nullptr, true) == expected);
+      if (t.size() == 1)
+        CHECK(score1<true>(n, hs) == expected);
+#if defined(FZX_SSE2)
+      if (t.size() <= 4)
+        CHECK(scoreSSE<4, true>(n, hs) == expected);
+      else if (t.size() <= 12)
+        CHECK(scoreSSE<12, true>(n, hs) == expected);
+      CHECK(scoreSSELong<true>(n, hs) == expected);
+#endif
+#if defined(FZX_NEON)
+      if (t.size() <= 4)
+        CHECK(scoreNeon<4, true>(n, hs) == expected);
+      else if (t.size() <= 12)
+        CHECK(scoreNeon<12, true>(n, hs) == expected);
+#endif
+    }
+
+#if defined(FZX_SSE2)
+    if (t.size() <= 3) {
+      std::string_view hs[kScoreBatch];
+      for (size_t j = 0; j < kScoreBatch; ++j)
+        hs[j] = haystacks[j];
+      Score scores[kScoreBatch];
+      if (t.size() == 1)
+        scoreBatchSSE<1, true>(n, hs, scores);
+      else if (t.size() == 2)
+        scoreBatchSSE<2, true>(n, hs, scores);
+      else
+        scoreBatchSSE<3, true>(n, hs, scores);
+      for (size_t j = 0; j < kScoreBatch; ++j) {
+        CAPTURE(hs[j].size());
+        CHECK(scores[j] == referenceScore(t, hs[j], true));
+      }
+    }
+#endif
+  }
+}
+
 #if defined(FZX_SSE2)
 TEST_CASE("fzx::scoreSse", "[score]")
 {
@@ -292,6 +550,85 @@ TEST_CASE("fzx::scoreSse", "[score]")
     }
   }
 }
+
+TEST_CASE("fzx::scoreSSELong", "[score]")
+{
+  auto h = "/Lorem/ipsum/dolor/sit/amet/consectetur/adipiscing/elit/"
+           "Maecenas/mollis/odio/semper/nunc/convallis/accumsan/"_s;
+
+  const std::vector<std::string_view> kTestCases {
+    "l"sv,
+    "lidsacaemmosnca"sv,
+    "lidsacaemmosncac"sv,
+    "lidsacaemmosncaca"sv,
+    "/lorem/ipsum/dolor/sit"sv,
+    "loremipsumdolorsitamet"sv,
+    "/////////////////////"sv,
+    "lorem/ipsum/dolor/sit/amet/consectetur/adipiscing/elit"sv,
+    "/Lorem/ipsum/dolor/sit/amet/consectetur/adipiscing/elit/Maecenas/mollis/odio/semper/"sv,
+    "mllsdsmprncnvllscmsn"sv,
+  };
+
+  for (auto t : kTestCases) {
+    CAPTURE(t);
+    fzx::AlignedString n { t };
+    CHECK(Approx(score(n, h)) == scoreSSELong(n, h));
+  }
+
+  // Every prefix and suffix of the haystack
+  for (size_t i = 1; i < h.size(); ++i) {
+    CAPTURE(i);
+    fzx::AlignedString p { std::string_view { h }.substr(0, i) };
+    fzx::AlignedString s { std::string_view { h }.substr(i) };
+    CHECK(Approx(score(p, h)) == scoreSSELong(p, h));
+    CHECK(Approx(score(s, h)) == scoreSSELong(s, h));
+  }
+
+  CHECK(scoreSSELong(fzx::AlignedString { h }, h) == kScoreMax);
+}
+
+TEST_CASE("fzx::scoreBatchSSE", "[score]")
+{
+  // Haystacks are padded like fzx::Items, the kernel loads whole 16 byte blocks
+  std::vector<fzx::AlignedString> kHaystacks;
+  for (const auto& h : {
+         "a"s,
+         "ab"s,
+         "abc"s,
+         "abcd"s,
+         "/a/b/c"s,
+         "A/B/C"s,
+         "xaxbxcx"s,
+         "ABCabcABC"s,
+         "src/fzx/score.cpp"s,
+         "b"s,
+         "xxxxxxxxxxxxxxx/a_b.cXaxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxx-b"s,
+         std::string(kMatchMaxLen, 'a'),
+         std::string(kMatchMaxLen + 1, 'a'),
+       })
+    kHaystacks.emplace_back(h);
+
+  for (auto t : { "a"sv, "ab"sv, "abc"sv, "c"sv, "bc"sv, "/b"sv }) {
+    CAPTURE(t);
+    fzx::AlignedString n { t };
+    for (size_t i = 0; i + kScoreBatch <= kHaystacks.size(); ++i) {
+      std::string_view hs[kScoreBatch];
+      for (size_t j = 0; j < kScoreBatch; ++j)
+        hs[j] = kHaystacks[i + j];
+      Score scores[kScoreBatch];
+      if (t.size() == 1)
+        scoreBatchSSE<1>(n, hs, scores);
+      else if (t.size() == 2)
+        scoreBatchSSE<2>(n, hs, scores);
+      else
+        scoreBatchSSE<3>(n, hs, scores);
+      for (size_t j = 0; j < kScoreBatch; ++j) {
+        CAPTURE(hs[j]);
+        CHECK(scores[j] == score(n, hs[j]));
+      }
+    }
+  }
+}
 #endif
 
 #if defined(FZX_NEON)
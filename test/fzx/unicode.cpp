@@ -0,0 +1,87 @@
+#include <catch2/catch_test_macros.hpp>
+
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "fzx/unicode.hpp"
+
+using namespace std::string_literals;
+using namespace std::string_view_literals;
+using namespace fzx;
+
+TEST_CASE("fzx::isAscii")
+{
+  CHECK(isAscii(""sv));
+  CHECK(isAscii("a"sv));
+  CHECK(isAscii("src/fzx/unicode.cpp"sv));
+  CHECK(!isAscii("é"sv));
+  CHECK(!isAscii("src/fzx/école"sv));
+  CHECK(!isAscii("0123456789abcdé"sv));
+  CHECK(!isAscii("\xFF"sv));
+}
+
+TEST_CASE("fzx::decodeUtf8")
+{
+  std::u32string out;
+  std::vector<uint32_t> offsets;
+
+  SECTION("valid") {
+    decodeUtf8("aé中\U0001F600"sv, out, &offsets);
+    CHECK(out == U"aé中\U0001F600"s);
+    CHECK(offsets == std::vector<uint32_t> { 0, 1, 3, 6, 10 });
+  }
+
+  SECTION("empty") {
+    decodeUtf8(""sv, out, &offsets);
+    CHECK(out.empty());
+    CHECK(offsets == std::vector<uint32_t> { 0 });
+  }
+
+  SECTION("invalid bytes are decoded one by one") {
+    decodeUtf8("\xFF" "a"sv, out);
+    CHECK(out == U"\xDCFF" U"a"s);
+    decodeUtf8("\xC3"sv, out); // Truncated
+    CHECK(out == U"\xDCC3"s);
+    decodeUtf8("\xC3" "a"sv, out); // Missing continuation byte
+    CHECK(out == U"\xDCC3" U"a"s);
+    decodeUtf8("\xC0\xAF"sv, out); // Overlong '/'
+    CHECK(out == U"\xDCC0\xDCAF"s);
+    decodeUtf8("\xED\xA0\x80"sv, out); // Surrogate
+    CHECK(out == U"\xDCED\xDCA0\xDC80"s);
+  }
+}
+
+TEST_CASE("fzx::foldCase")
+{
+  CHECK(foldCase(U'A') == U'a');
+  CHECK(foldCase(U'a') == U'a');
+  CHECK(foldCase(U'/') == U'/');
+  CHECK(foldCase(U'É') == U'é'); // É
+  CHECK(foldCase(U'×') == U'×'); // ×
+  CHECK(foldCase(U'Ā') == U'ā'); // Ā
+  CHECK(foldCase(U'Ł') == U'ł'); // Ł
+  CHECK(foldCase(U'Ÿ') == U'ÿ'); // Ÿ
+  CHECK(foldCase(U'İ') == U'İ'); // İ stays non-ASCII
+  CHECK(foldCase(U'Σ') == U'σ'); // Σ
+  CHECK(foldCase(U'Έ') == U'έ'); // Έ
+  CHECK(foldCase(U'Ж') == U'ж'); // Ж
+  CHECK(foldCase(U'Ё') == U'ё'); // Ё
+  CHECK(foldCase(U'ẞ') == U'ß'); // ẞ
+  CHECK(foldCase(U'Ａ') == U'ａ'); // Ａ
+  CHECK(foldCase(U'中') == U'中');
+
+  // Non-ASCII characters never fold to ASCII
+  for (char32_t ch = 0x80; ch < 0x10000; ++ch)
+    REQUIRE(foldCase(ch) >= 0x80);
+}
+
+TEST_CASE("fzx::hasUppercase")
+{
+  CHECK(!hasUppercase(""sv));
+  CHECK(!hasUppercase("foo/bar.cpp"sv));
+  CHECK(hasUppercase("foo/Bar.cpp"sv));
+  CHECK(!hasUppercase("école"sv));
+  CHECK(hasUppercase("École"sv));
+  CHECK(!hasUppercase("中"sv));
+}